@@ -0,0 +1,275 @@
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "Builtins.hh"
+
+namespace posix_util
+{
+   namespace
+   {
+      bool is_help(const std::vector<std::string>& args)
+      //------------------------------------------------
+      {
+         return ( (args.size() == 1) && ( (args[0] == "--help") || (args[0] == "--version") ) );
+      }
+
+      // Names coreutils prints unquoted in diagnostics
+      bool is_plain_name(const std::string& name)
+      //-----------------------------------------
+      {
+         if (name.empty())
+            return false;
+         for (char c : name)
+         {
+            if ( (! std::isalnum(static_cast<unsigned char>(c))) && (std::strchr("%+,-./:@_", c) == nullptr) )
+               return false;
+         }
+         return true;
+      }
+
+      int echo_command(const std::vector<std::string>& args, std::string& out, std::string&)
+      //-------------------------------------------------------------------------------------
+      {
+         if (is_help(args))
+            return Builtins::not_handled;
+         bool is_newline = true;
+         std::size_t first = 0;
+         for (; first < args.size(); first++)
+         {
+            const std::string& arg = args[first];
+            if ( (arg.size() < 2) || (arg[0] != '-') || (arg.find_first_not_of("neE", 1) != std::string::npos) )
+               break;
+            if (arg.find('e') != std::string::npos) // Escape interpretation is left to the real echo
+               return Builtins::not_handled;
+            if (arg.find('n') != std::string::npos)
+               is_newline = false;
+         }
+         for (std::size_t i = first; i < args.size(); i++)
+         {
+            if (i > first)
+               out += ' ';
+            out += args[i];
+         }
+         if (is_newline)
+            out += '\n';
+         return 0;
+      }
+
+      int cat_command(const std::vector<std::string>& args, std::string& out, std::string& err)
+      //----------------------------------------------------------------------------------------
+      {
+         if (args.empty()) // Reads stdin
+            return Builtins::not_handled;
+         for (const std::string& arg : args)
+         {
+            if ( (! arg.empty()) && (arg[0] == '-') ) // Options or stdin
+               return Builtins::not_handled;
+         }
+         int status = 0;
+         char buf[65536];
+         for (const std::string& name : args)
+         {
+            int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+            ssize_t count = 0;
+            if (fd >= 0)
+            {
+               while ( ((count = read(fd, buf, sizeof(buf))) > 0) || ( (count < 0) && (errno == EINTR) ) )
+               {
+                  if (count > 0)
+                     out.append(buf, static_cast<std::size_t>(count));
+               }
+            }
+            if ( (fd < 0) || (count < 0) )
+            {
+               int error = errno;
+               if (! is_plain_name(name))
+               {
+                  if (fd >= 0) close(fd);
+                  return Builtins::not_handled;
+               }
+               err += "cat: " + name + ": " + std::strerror(error) + "\n";
+               status = 1;
+            }
+            if (fd >= 0)
+               close(fd);
+         }
+         return status;
+      }
+
+      // Accepts the plain decimal integers whose comparison matches test exactly
+      bool parse_integer(const std::string& s, std::int64_t& value)
+      //-----------------------------------------------------------
+      {
+         std::size_t start = ( (! s.empty()) && ( (s[0] == '-') || (s[0] == '+') ) ) ? 1 : 0;
+         if ( (s.size() == start) || (s.size() - start > 18) ||
+              (s.find_first_not_of("0123456789", start) != std::string::npos) )
+            return false;
+         value = std::stoll(s);
+         return true;
+      }
+
+      int test_unary(const std::string& op, const std::string& operand)
+      //---------------------------------------------------------------
+      {
+         if (op == "-z") return (operand.empty()) ? 0 : 1;
+         if (op == "-n") return (operand.empty()) ? 1 : 0;
+         int mode = 0;
+         if (op == "-r") mode = R_OK;
+         else if (op == "-w") mode = W_OK;
+         else if (op == "-x") mode = X_OK;
+         if (mode != 0)
+            return (access(operand.c_str(), mode) == 0) ? 0 : 1;
+         if ( (op.size() != 2) || (op[0] != '-') || (std::strchr("bcdefghkLpsSu", op[1]) == nullptr) )
+            return Builtins::not_handled;
+         struct stat st;
+         bool is_link = ( (op == "-h") || (op == "-L") );
+         if ( ((is_link) ? lstat(operand.c_str(), &st) : stat(operand.c_str(), &st)) != 0 )
+            return 1;
+         bool is_true;
+         switch (op[1])
+         {
+            case 'b': is_true = S_ISBLK(st.st_mode); break;
+            case 'c': is_true = S_ISCHR(st.st_mode); break;
+            case 'd': is_true = S_ISDIR(st.st_mode); break;
+            case 'e': is_true = true; break;
+            case 'f': is_true = S_ISREG(st.st_mode); break;
+            case 'g': is_true = ((st.st_mode & S_ISGID) != 0); break;
+            case 'h': case 'L': is_true = S_ISLNK(st.st_mode); break;
+            case 'k': is_true = ((st.st_mode & S_ISVTX) != 0); break;
+            case 'p': is_true = S_ISFIFO(st.st_mode); break;
+            case 's': is_true = (st.st_size > 0); break;
+            case 'S': is_true = S_ISSOCK(st.st_mode); break;
+            default: is_true = ((st.st_mode & S_ISUID) != 0); break; // 'u'
+         }
+         return (is_true) ? 0 : 1;
+      }
+
+      int test_binary(const std::string& left, const std::string& op, const std::string& right)
+      //--------------------------------------------------------------------------------------
+      {
+         if ( (op == "=") || (op == "==") ) return (left == right) ? 0 : 1;
+         if (op == "!=") return (left != right) ? 0 : 1;
+         if (op == "-a") return ( (! left.empty()) && (! right.empty()) ) ? 0 : 1;
+         if (op == "-o") return ( (! left.empty()) || (! right.empty()) ) ? 0 : 1;
+         static const char* const comparisons[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+         int which = -1;
+         for (int i = 0; i < 6; i++)
+            if (op == comparisons[i]) which = i;
+         std::int64_t l, r;
+         if ( (which < 0) || (! parse_integer(left, l)) || (! parse_integer(right, r)) )
+            return Builtins::not_handled;
+         bool results[] = { l == r, l != r, l < r, l <= r, l > r, l >= r };
+         return (results[which]) ? 0 : 1;
+      }
+
+      bool is_binary(const std::string& op)
+      //-----------------------------------
+      {
+         static const char* const ops[] = { "=", "==", "!=", "-a", "-o", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+                                            "-nt", "-ot", "-ef", "<", ">" };
+         for (const char* candidate : ops)
+            if (op == candidate) return true;
+         return false;
+      }
+
+      int negate(int status) { return (status == Builtins::not_handled) ? status : 1 - status; }
+
+      // POSIX argument count rules, expressions needing the full grammar (or an error message) are not handled
+      int test_expression(const std::vector<std::string>& args, std::size_t first)
+      //--------------------------------------------------------------------------
+      {
+         std::size_t n = args.size() - first;
+         const std::string* a = args.data() + first;
+         switch (n)
+         {
+            case 0: return 1;
+            case 1: return (a[0].empty()) ? 1 : 0;
+            case 2:
+               if (a[0] == "!") return (a[1].empty()) ? 0 : 1;
+               return test_unary(a[0], a[1]);
+            case 3:
+               if (is_binary(a[1])) return test_binary(a[0], a[1], a[2]);
+               if (a[0] == "!") return negate(test_expression(args, first + 1));
+               if ( (a[0] == "(") && (a[2] == ")") ) return (a[1].empty()) ? 1 : 0;
+               return Builtins::not_handled;
+            case 4:
+               if (a[0] == "!") return negate(test_expression(args, first + 1));
+               if ( (a[0] == "(") && (a[3] == ")") )
+               {
+                  std::vector<std::string> inner(a + 1, a + 3);
+                  return test_expression(inner, 0);
+               }
+               return Builtins::not_handled;
+            default:
+               return Builtins::not_handled;
+         }
+      }
+
+      int test_command(const std::vector<std::string>& args, std::string&, std::string&)
+      //---------------------------------------------------------------------------------
+      {
+         return test_expression(args, 0);
+      }
+   }
+
+   Builtins& Builtins::instance()
+   //----------------------------
+   {
+      static Builtins builtins;
+      return builtins;
+   }
+
+   Builtins::Builtins()
+   //------------------
+   {
+      commands["true"] = [](const std::vector<std::string>& args, std::string&, std::string&)
+                         { return (is_help(args)) ? not_handled : 0; };
+      commands["false"] = [](const std::vector<std::string>& args, std::string&, std::string&)
+                          { return (is_help(args)) ? not_handled : 1; };
+      commands["echo"] = &echo_command;
+      commands["cat"] = &cat_command;
+      commands["test"] = &test_command;
+   }
+
+   void Builtins::add(const std::string& name, BuiltinCommand command)
+   //-----------------------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      commands[name] = std::move(command);
+   }
+
+   void Builtins::remove(const std::string& name)
+   //--------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      commands.erase(name);
+   }
+
+   bool Builtins::contains(const std::string& name) const
+   //----------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      return (commands.find(name) != commands.end());
+   }
+
+   int Builtins::run(const std::string& name, const std::vector<std::string>& args, std::string& out,
+                     std::string& err) const
+   //--------------------------------------------------------------------------------------------------
+   {
+      BuiltinCommand command;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         auto it = commands.find(name);
+         if (it == commands.end())
+            return not_handled;
+         command = it->second;
+      }
+      return command(args, out, err);
+   }
+}
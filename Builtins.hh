@@ -0,0 +1,41 @@
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _5a2e8c1f7d934b06a4f3e9b2c7d1085e
+#define _5a2e8c1f7d934b06a4f3e9b2c7d1085e
+namespace posix_util
+{
+   // Emulation of a command run in process. Appends what the command would write to out and err and returns its
+   // exit status, or Builtins::not_handled if the arguments need the real command.
+   typedef std::function<int(const std::vector<std::string>& args, std::string& out, std::string& err)> BuiltinCommand;
+
+   // Registry of in-process emulations of trivial commands used by Process::set_builtin to avoid a fork and exec.
+   // true, false, echo (-n), cat (files only) and test (up to four arguments) are registered initially with the
+   // stdout, stderr and exit status of the coreutils versions; anything they do not emulate exactly is left to
+   // the real command.
+   class Builtins
+   //============
+   {
+   public:
+      static constexpr int not_handled = -1;
+
+      static Builtins& instance();
+      Builtins(const Builtins& other) = delete;
+      Builtins& operator=(const Builtins& other) = delete;
+
+      void add(const std::string& name, BuiltinCommand command);
+      void remove(const std::string& name);
+      bool contains(const std::string& name) const;
+      int run(const std::string& name, const std::vector<std::string>& args, std::string& out, std::string& err) const;
+
+   private:
+      Builtins();
+
+      mutable std::mutex mtx;
+      std::unordered_map<std::string, BuiltinCommand> commands;
+   };
+}
+#endif
@@ -0,0 +1,108 @@
+#include <cstdio>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "CaptureBudget.hh"
+
+namespace posix_util
+{
+   CaptureBudget& CaptureBudget::instance()
+   //--------------------------------------
+   {
+      static CaptureBudget budget;
+      return budget;
+   }
+
+   CaptureBudget::CaptureBudget() : budget_limit(0), low_water(0), budget_used(0), peak_used(0), producer_count(0),
+                                    throttled_count(0), events(0), total_throttled_ns(0), max_throttle(100)
+   //--------------------------------------------------------------------------------------------------------------
+   {
+      event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (event_fd < 0)
+         perror("eventfd (CaptureBudget)");
+   }
+
+   CaptureBudget::~CaptureBudget()
+   //-----------------------------
+   {
+      if (event_fd >= 0)
+         close(event_fd);
+   }
+
+   void CaptureBudget::set_limit(std::size_t bytes, unsigned low_water_percent)
+   //--------------------------------------------------------------------------
+   {
+      if (low_water_percent > 100) low_water_percent = 100;
+      low_water = (bytes / 100) * low_water_percent;
+      budget_limit = bytes;
+      if ( (throttled_count.load() > 0) && ( (bytes == 0) || (used() <= low_water.load()) ) )
+         wake(); // Resume anything throttled under the previous limit
+   }
+
+   void CaptureBudget::wake()
+   //------------------------
+   {
+      std::uint64_t one = 1;
+      if ( (event_fd >= 0) && (write(event_fd, &one, sizeof(one)) < 0) )
+         perror("write (CaptureBudget)");
+   }
+
+   bool CaptureBudget::is_exceeded() const
+   //-------------------------------------
+   {
+      std::size_t max = budget_limit.load(std::memory_order_relaxed);
+      return ( (max > 0) && (budget_used.load(std::memory_order_relaxed) > max) );
+   }
+
+   // True if a process holding charged bytes has at least an average share of the used memory
+   bool CaptureBudget::is_heavy(std::size_t charged) const
+   //-----------------------------------------------------
+   {
+      std::size_t producers = producer_count.load(std::memory_order_relaxed);
+      return ( (producers > 0) && (charged > 0) && (charged * producers >= budget_used.load(std::memory_order_relaxed)) );
+   }
+
+   // Called by a Process when its capture memory changes from previous to current bytes
+   void CaptureBudget::adjust(std::size_t previous, std::size_t current)
+   //-------------------------------------------------------------------
+   {
+      if ( (previous == 0) && (current > 0) )
+         producer_count++;
+      else if ( (previous > 0) && (current == 0) )
+         producer_count--;
+      std::size_t now;
+      if (current >= previous)
+      {
+         now = (budget_used += current - previous);
+         std::size_t peak = peak_used.load(std::memory_order_relaxed);
+         while ( (now > peak) && (! peak_used.compare_exchange_weak(peak, now)) ) {}
+         return;
+      }
+      now = (budget_used -= previous - current);
+      std::size_t max = budget_limit.load(std::memory_order_relaxed);
+      if ( (throttled_count.load() > 0) && ( (max == 0) || (now <= low_water.load(std::memory_order_relaxed)) ) )
+         wake();
+   }
+
+   void CaptureBudget::throttle_started()
+   //------------------------------------
+   {
+      throttled_count++;
+      events++;
+   }
+
+   void CaptureBudget::throttle_ended(std::uint64_t throttled_ns)
+   //------------------------------------------------------------
+   {
+      throttled_count--;
+      total_throttled_ns += throttled_ns;
+   }
+
+   CaptureBudget::Metrics CaptureBudget::metrics() const
+   //---------------------------------------------------
+   {
+      return Metrics{ budget_limit.load(), budget_used.load(), peak_used.load(), producer_count.load(),
+                      throttled_count.load(), events.load(), total_throttled_ns.load() };
+   }
+}
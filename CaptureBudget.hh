@@ -0,0 +1,64 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef _0d6b9f3e2a714c58b7e1f4a9c3d5e862
+#define _0d6b9f3e2a714c58b7e1f4a9c3d5e862
+namespace posix_util
+{
+   // Process wide accounting of capture buffer memory. With a limit set, the background drainer (see
+   // Process::set_background_drain) stops reading the pipes of the heaviest producers (those holding at least
+   // an average share of the captured memory) while the limit is exceeded, so the pipe buffers fill and block
+   // those children until memory is released (captures cleared, compressed or the Process destroyed) below the
+   // low water mark. Captures read on the calling thread (sync_execute, read_all_after_death) are accounted
+   // but never throttled as nothing else would release memory.
+   // A blocked child cannot exit, so a caller which waits for children to finish before releasing their output
+   // would wait forever. To avoid that a pipe throttled for max_throttle_ms is read once more (and throttled
+   // again if still over the limit), so throttled children slow down but still make progress and usage can
+   // exceed the limit by a read per pipe per interval. set_max_throttle(0) throttles until memory is released,
+   // only use it when output is consumed or cleared while children run.
+   class CaptureBudget
+   //=================
+   {
+   public:
+      struct Metrics
+      {
+         std::size_t limit, used, peak;
+         std::size_t producers;        // Processes currently holding capture memory
+         std::size_t throttled;        // Pipes not currently being read
+         std::uint64_t throttle_events;
+         std::uint64_t throttled_ns;   // Total time pipes have spent throttled
+      };
+
+      static CaptureBudget& instance();
+      ~CaptureBudget();
+      CaptureBudget(const CaptureBudget& other) = delete;
+      CaptureBudget& operator=(const CaptureBudget& other) = delete;
+
+      // 0 for unlimited, reading resumes once usage falls to low_water_percent of the limit
+      void set_limit(std::size_t bytes, unsigned low_water_percent = 90);
+      std::size_t limit() const { return budget_limit.load(std::memory_order_relaxed); }
+      std::size_t used() const { return budget_used.load(std::memory_order_relaxed); }
+      void set_max_throttle(unsigned ms) { max_throttle = ms; }
+      unsigned max_throttle_ms() const { return max_throttle.load(std::memory_order_relaxed); }
+      bool is_exceeded() const;
+      bool is_heavy(std::size_t charged) const;
+      void adjust(std::size_t previous, std::size_t current);
+      Metrics metrics() const;
+
+      // Used by the background drainer
+      int release_fd() const { return event_fd; }
+      void throttle_started();
+      void throttle_ended(std::uint64_t throttled_ns);
+
+   private:
+      CaptureBudget();
+      void wake();
+
+      std::atomic<std::size_t> budget_limit, low_water, budget_used, peak_used, producer_count, throttled_count;
+      std::atomic<std::uint64_t> events, total_throttled_ns;
+      std::atomic<unsigned> max_throttle;
+      int event_fd;
+   };
+}
+#endif
@@ -0,0 +1,92 @@
+#if defined(POSIX_UTIL_ZSTD)
+#include <zstd.h>
+#elif defined(POSIX_UTIL_LZ4)
+#include <lz4.h>
+#elif defined(POSIX_UTIL_ZLIB)
+#include <zlib.h>
+#endif
+#include <climits>
+
+#include "CaptureCodec.hh"
+
+namespace posix_util
+{
+   const char* CaptureCodec::name()
+   //------------------------------
+   {
+#if defined(POSIX_UTIL_ZSTD)
+      return "zstd";
+#elif defined(POSIX_UTIL_LZ4)
+      return "lz4";
+#elif defined(POSIX_UTIL_ZLIB)
+      return "zlib";
+#else
+      return "none";
+#endif
+   }
+
+   bool CaptureCodec::available()
+   //----------------------------
+   {
+#if defined(POSIX_UTIL_ZSTD) || defined(POSIX_UTIL_LZ4) || defined(POSIX_UTIL_ZLIB)
+      return true;
+#else
+      return false;
+#endif
+   }
+
+   bool CaptureCodec::compress(std::string_view in, std::string& out)
+   //----------------------------------------------------------------
+   {
+#if defined(POSIX_UTIL_ZSTD)
+      out.resize(ZSTD_compressBound(in.size()));
+      std::size_t len = ZSTD_compress(out.data(), out.size(), in.data(), in.size(), 1);
+      if (ZSTD_isError(len))
+         return false;
+#elif defined(POSIX_UTIL_LZ4)
+      if (in.size() > static_cast<std::size_t>(LZ4_MAX_INPUT_SIZE))
+         return false;
+      out.resize(static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(in.size()))));
+      int len = LZ4_compress_default(in.data(), out.data(), static_cast<int>(in.size()), static_cast<int>(out.size()));
+      if (len <= 0)
+         return false;
+#elif defined(POSIX_UTIL_ZLIB)
+      if (in.size() > ULONG_MAX)
+         return false;
+      uLongf len = compressBound(static_cast<uLong>(in.size()));
+      out.resize(len);
+      if (compress2(reinterpret_cast<Bytef*>(out.data()), &len, reinterpret_cast<const Bytef*>(in.data()),
+                    static_cast<uLong>(in.size()), Z_BEST_SPEED) != Z_OK)
+         return false;
+#else
+      (void) in;
+      std::size_t len = 0;
+      out.clear();
+      return false;
+#endif
+      out.resize(static_cast<std::size_t>(len));
+      out.shrink_to_fit();
+      return true;
+   }
+
+   bool CaptureCodec::decompress(std::string_view in, std::size_t original_size, std::string& out)
+   //---------------------------------------------------------------------------------------------
+   {
+      out.resize(original_size);
+#if defined(POSIX_UTIL_ZSTD)
+      std::size_t len = ZSTD_decompress(out.data(), out.size(), in.data(), in.size());
+      return ( (! ZSTD_isError(len)) && (len == original_size) );
+#elif defined(POSIX_UTIL_LZ4)
+      int len = LZ4_decompress_safe(in.data(), out.data(), static_cast<int>(in.size()), static_cast<int>(out.size()));
+      return ( (len >= 0) && (static_cast<std::size_t>(len) == original_size) );
+#elif defined(POSIX_UTIL_ZLIB)
+      uLongf len = static_cast<uLongf>(original_size);
+      return ( (uncompress(reinterpret_cast<Bytef*>(out.data()), &len, reinterpret_cast<const Bytef*>(in.data()),
+                           static_cast<uLong>(in.size())) == Z_OK) && (len == original_size) );
+#else
+      (void) in;
+      out.clear();
+      return false;
+#endif
+   }
+}
@@ -0,0 +1,22 @@
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#ifndef _b83e1d6f4a2c4f90a7d5e3c1b9f60d28
+#define _b83e1d6f4a2c4f90a7d5e3c1b9f60d28
+namespace posix_util
+{
+   // Fast LZ family codec used to compress completed captures. The codec is chosen at build time (zstd, lz4 or
+   // zlib in order of preference, see CMakeLists.txt). Without one compress always fails so captures are left
+   // uncompressed.
+   class CaptureCodec
+   //================
+   {
+   public:
+      static const char* name();
+      static bool available();
+      static bool compress(std::string_view in, std::string& out);
+      static bool decompress(std::string_view in, std::size_t original_size, std::string& out);
+   };
+}
+#endif
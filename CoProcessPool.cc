@@ -0,0 +1,313 @@
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "CoProcessPool.hh"
+#include "Process.hh"
+
+namespace posix_util
+{
+   namespace
+   {
+      // Blocks SIGCHLD on this thread for its lifetime. The Process child death handler allocates while capturing
+      // the remaining output of a worker, so it must not interrupt this thread inside the allocator or a spawn.
+      class ChildSignalBlock
+      //====================
+      {
+      public:
+         ChildSignalBlock()
+         {
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGCHLD);
+            pthread_sigmask(SIG_BLOCK, &mask, &previous);
+         }
+         ~ChildSignalBlock() { pthread_sigmask(SIG_SETMASK, &previous, nullptr); }
+         ChildSignalBlock(const ChildSignalBlock&) = delete;
+         ChildSignalBlock& operator=(const ChildSignalBlock&) = delete;
+
+      private:
+         sigset_t previous;
+      };
+
+      // Writes all of the iovecs to fd with SIGPIPE blocked (and any it raised discarded) so a dead worker is
+      // reported as EPIPE rather than terminating the caller.
+      bool write_frame(int fd, struct iovec* iov, int iovcnt)
+      //-----------------------------------------------------
+      {
+         sigset_t pipe_mask, previous;
+         sigemptyset(&pipe_mask);
+         sigaddset(&pipe_mask, SIGPIPE);
+         pthread_sigmask(SIG_BLOCK, &pipe_mask, &previous);
+         bool is_ok = true;
+         while (iovcnt > 0)
+         {
+            ssize_t count = writev(fd, iov, iovcnt);
+            if (count < 0)
+            {
+               if (errno == EINTR) continue;
+               is_ok = false;
+               break;
+            }
+            while ( (iovcnt > 0) && (static_cast<std::size_t>(count) >= iov->iov_len) )
+            {
+               count -= static_cast<ssize_t>(iov->iov_len);
+               iov++;
+               iovcnt--;
+            }
+            if (iovcnt > 0)
+            {
+               iov->iov_base = static_cast<char*>(iov->iov_base) + count;
+               iov->iov_len -= static_cast<std::size_t>(count);
+            }
+         }
+         if (! is_ok)
+         {
+            struct timespec zero = { 0, 0 };
+            while (sigtimedwait(&pipe_mask, nullptr, &zero) > 0) {}
+         }
+         pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+         return is_ok;
+      }
+
+      // Reads exactly len bytes unless EOF, an error or the deadline (if timeout_ms > 0) intervenes
+      bool read_exact(int fd, char* data, std::size_t len, int timeout_ms,
+                      std::chrono::steady_clock::time_point deadline)
+      //----------------------------------------------------------------
+      {
+         while (len > 0)
+         {
+            int wait_ms = -1;
+            if (timeout_ms > 0)
+            {
+               auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+               if (remaining.count() <= 0)
+                  return false;
+               wait_ms = static_cast<int>(remaining.count());
+            }
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            int ret = poll(&pfd, 1, wait_ms);
+            if (ret < 0)
+            {
+               if (errno == EINTR) continue;
+               return false;
+            }
+            if (ret == 0)
+               return false;
+            ssize_t count = read(fd, data, len);
+            if (count < 0)
+            {
+               if ( (errno == EINTR) || (errno == EAGAIN) ) continue;
+               return false;
+            }
+            if (count == 0)
+               return false;
+            data += count;
+            len -= static_cast<std::size_t>(count);
+         }
+         return true;
+      }
+   }
+
+   CoProcessPool::CoProcessPool(const std::string& path, const std::vector<std::string>& args, std::size_t n,
+                                std::size_t max_requests)
+   //------------------------------------------------------------------------------------------------------
+      : executable(path), arguments(args), workers(n), request_limit(max_requests),
+        response_limit(64 * 1024 * 1024), restart_count(0), recycle_count(0), is_started(false)
+   {
+   }
+
+   CoProcessPool::~CoProcessPool() { stop(); }
+
+   void CoProcessPool::frame_header(std::size_t len, unsigned char header[4])
+   //------------------------------------------------------------------------
+   {
+      header[0] = static_cast<unsigned char>((len >> 24) & 0xFF);
+      header[1] = static_cast<unsigned char>((len >> 16) & 0xFF);
+      header[2] = static_cast<unsigned char>((len >> 8) & 0xFF);
+      header[3] = static_cast<unsigned char>(len & 0xFF);
+   }
+
+   bool CoProcessPool::start()
+   //-------------------------
+   {
+      ChildSignalBlock block;
+      std::lock_guard<std::mutex> lock(mtx);
+      if (is_started)
+         return true;
+      for (Worker& worker : workers)
+      {
+         if (! spawn(worker, last_error_mess))
+         {
+            for (Worker& started : workers)
+               retire(started, true);
+            return false;
+         }
+      }
+      is_started = true;
+      return true;
+   }
+
+   void CoProcessPool::stop()
+   //------------------------
+   {
+      ChildSignalBlock block;
+      std::unique_lock<std::mutex> lock(mtx);
+      if (! is_started)
+         return;
+      is_started = false;
+      idle.notify_all();
+      idle.wait(lock, [this]()
+      {
+         for (const Worker& worker : workers)
+            if (worker.is_busy) return false;
+         return true;
+      });
+      for (Worker& worker : workers)
+         retire(worker, false);
+   }
+
+   // Called concurrently by request() for different workers, so failures are returned in error rather than
+   // stored in last_error_mess
+   bool CoProcessPool::spawn(Worker& worker, std::string& error)
+   //-----------------------------------------------------------
+   {
+      std::shared_ptr<Process> process = std::make_shared<Process>(executable);
+      process->set_stdin_pipe();
+      std::vector<std::string> args = arguments;
+      if (! process->async_execute(args, process, true, false))
+      {
+         error = "Starting worker " + executable + ": " + process->last_error_message();
+         return false;
+      }
+      worker.process = process;
+      worker.requests = 0;
+      return true;
+   }
+
+   void CoProcessPool::set_error(const std::string& error)
+   //-----------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      last_error_mess = error;
+   }
+
+   std::string CoProcessPool::last_error() const
+   //-------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      return last_error_mess;
+   }
+
+   // Closing stdin asks a worker to exit, it is reaped by the Process child death handler
+   void CoProcessPool::retire(Worker& worker, bool is_kill)
+   //------------------------------------------------------
+   {
+      if (! worker.process)
+         return;
+      worker.process->close_stdin();
+      if (is_kill)
+         worker.process->kill_async(worker.process, { {SIGKILL, 0} });
+      worker.process.reset();
+   }
+
+   CoProcessPool::Worker* CoProcessPool::acquire()
+   //---------------------------------------------
+   {
+      std::unique_lock<std::mutex> lock(mtx);
+      Worker* found = nullptr;
+      idle.wait(lock, [this, &found]()
+      {
+         if (! is_started)
+            return true;
+         for (Worker& worker : workers)
+         {
+            if (! worker.is_busy)
+            {
+               found = &worker;
+               return true;
+            }
+         }
+         return false;
+      });
+      if (found != nullptr)
+         found->is_busy = true;
+      return found;
+   }
+
+   void CoProcessPool::release(Worker* worker)
+   //-----------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      worker->is_busy = false;
+      idle.notify_all();
+   }
+
+   bool CoProcessPool::exchange(Worker& worker, std::string_view request, std::string& response, int timeout_ms)
+   //----------------------------------------------------------------------------------------------------------
+   {
+      unsigned char header[4];
+      frame_header(request.size(), header);
+      struct iovec iov[2] = { { header, sizeof(header) }, { const_cast<char*>(request.data()), request.size() } };
+      if (! write_frame(worker.process->stdin_fd(), iov, (request.empty()) ? 1 : 2))
+         return false;
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+      int out = worker.process->stdout_fd();
+      if (! read_exact(out, reinterpret_cast<char*>(header), sizeof(header), timeout_ms, deadline))
+         return false;
+      std::size_t len = (static_cast<std::size_t>(header[0]) << 24) | (static_cast<std::size_t>(header[1]) << 16) |
+                        (static_cast<std::size_t>(header[2]) << 8) | static_cast<std::size_t>(header[3]);
+      if (len > response_limit) // A failing or desynchronised worker, not read into memory
+      {
+         set_error("Response of " + std::to_string(len) + " bytes exceeds max_response");
+         return false;
+      }
+      response.resize(len);
+      return read_exact(out, response.data(), len, timeout_ms, deadline);
+   }
+
+   // Sends request to an idle worker and waits (up to timeout_ms if > 0) for its response. A worker which
+   // fails before responding is replaced and the request retried once on the replacement.
+   bool CoProcessPool::request(std::string_view request, std::string& response, int timeout_ms)
+   //-------------------------------------------------------------------------------------------
+   {
+      ChildSignalBlock block;
+      Worker* worker = acquire();
+      if (worker == nullptr)
+      {
+         set_error("Pool not started");
+         return false;
+      }
+      bool is_ok = false;
+      std::string error;
+      for (int attempt = 0; ( (attempt < 2) && (! is_ok) ); attempt++)
+      {
+         if ( (! worker->process) && (! spawn(*worker, error)) )
+         {
+            set_error(error);
+            break;
+         }
+         is_ok = exchange(*worker, request, response, timeout_ms);
+         if (! is_ok)
+         {
+            retire(*worker, true);
+            restart_count++;
+         }
+      }
+      if ( (is_ok) && (request_limit > 0) && (++worker->requests >= request_limit) )
+      {
+         retire(*worker, false);
+         recycle_count++;
+         if (! spawn(*worker, error)) // Retried by the next request on this worker
+            set_error(error);
+      }
+      release(worker);
+      return is_ok;
+   }
+}
@@ -0,0 +1,72 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _e81c4a7d2f0b4953a6d8c1e5b3f9a274
+#define _e81c4a7d2f0b4953a6d8c1e5b3f9a274
+namespace posix_util
+{
+   class Process;
+
+   // Pool of long lived worker processes amortizing exec and startup costs over many requests. Workers read
+   // requests from stdin and write one response per request to stdout, both framed as a 4 byte big endian
+   // length followed by the payload (see frame_header and LengthPrefixedDecoder). request() may be called
+   // from multiple threads, each call is dispatched to an idle worker (waiting for one if all are busy).
+   // Workers which exit, fail or time out are replaced and workers are recycled after max_requests requests
+   // (0 for never). A response frame longer than max_response() is not read, the worker is treated as failed.
+   class CoProcessPool
+   //=================
+   {
+   public:
+      CoProcessPool(const std::string& path, const std::vector<std::string>& args, std::size_t workers,
+                    std::size_t max_requests = 0);
+      ~CoProcessPool();
+      CoProcessPool(const CoProcessPool& other) = delete;
+      CoProcessPool& operator=(const CoProcessPool& other) = delete;
+
+      bool start();
+      void stop();
+      bool request(std::string_view request, std::string& response, int timeout_ms = 0);
+      std::size_t size() const { return workers.size(); }
+      std::uint64_t restarts() const { return restart_count; }
+      std::uint64_t recycles() const { return recycle_count; }
+      void set_max_response(std::size_t bytes) { response_limit = bytes; }
+      std::size_t max_response() const { return response_limit; }
+      std::string last_error() const;
+
+      static void frame_header(std::size_t len, unsigned char header[4]);
+
+   private:
+      struct Worker
+      {
+         std::shared_ptr<Process> process;
+         std::size_t requests = 0;
+         bool is_busy = false;
+      };
+
+      bool spawn(Worker& worker, std::string& error);
+      void set_error(const std::string& error);
+      void retire(Worker& worker, bool is_kill);
+      Worker* acquire();
+      void release(Worker* worker);
+      bool exchange(Worker& worker, std::string_view request, std::string& response, int timeout_ms);
+
+      std::string executable;
+      std::vector<std::string> arguments;
+      std::vector<Worker> workers;
+      std::size_t request_limit;
+      std::atomic<std::size_t> response_limit;
+      std::atomic<std::uint64_t> restart_count, recycle_count;
+      bool is_started;
+      std::string last_error_mess; // Guarded by mtx
+      mutable std::mutex mtx;
+      std::condition_variable idle;
+   };
+}
+#endif
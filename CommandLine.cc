@@ -0,0 +1,436 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "CommandLine.hh"
+#include "ExecPrefetch.hh"
+#include "Process.hh"
+
+namespace posix_util
+{
+   namespace
+   {
+      struct Token
+      {
+         enum class Kind { word, pipe, and_then, redirect } kind;
+         std::string text;
+         bool is_assignment = false; // Word with an unquoted = (a variable assignment as a command name)
+         CommandLine::Redirection redirection = { -1, "", 0, -1 };
+      };
+
+      // Commands which only make sense inside a shell (compound commands or changing the shell's own state)
+      bool is_shell_word(const std::string& word)
+      //-----------------------------------------
+      {
+         static const char* const words[] = { "!", "{", "}", "if", "then", "else", "elif", "fi", "for", "while",
+                                              "until", "do", "done", "case", "esac", "function", "cd", "exec",
+                                              "exit", "export", "unset", "set", "source", ".", "eval", "alias" };
+         for (const char* candidate : words)
+            if (word == candidate) return true;
+         return false;
+      }
+
+      bool unsupported(std::string& error, const std::string& what)
+      //-----------------------------------------------------------
+      {
+         error = "Unsupported shell syntax: " + what;
+         return false;
+      }
+
+      bool read_word(std::string_view line, std::size_t& i, Token& token, std::string& error)
+      //-------------------------------------------------------------------------------------
+      {
+         std::size_t n = line.size(), start = i;
+         bool is_digits = true;
+         while (i < n)
+         {
+            char c = line[i];
+            if ( (c == ' ') || (c == '\t') || (c == '\n') || (std::strchr("|&<>", c) != nullptr) )
+               break;
+            if (c == '\'')
+            {
+               std::size_t close = line.find('\'', i + 1);
+               if (close == std::string_view::npos)
+                  return unsupported(error, "unterminated single quote");
+               token.text.append(line.substr(i + 1, close - i - 1));
+               i = close + 1;
+               is_digits = false;
+               continue;
+            }
+            if (c == '"')
+            {
+               for (i++; ( (i < n) && (line[i] != '"') ); i++)
+               {
+                  if ( (line[i] == '$') || (line[i] == '`') )
+                     return unsupported(error, std::string("expansion (") + line[i] + ") in double quotes");
+                  if ( (line[i] == '\\') && (i + 1 < n) && (std::strchr("$`\"\\\n", line[i + 1]) != nullptr) )
+                  {
+                     if (line[++i] != '\n')
+                        token.text += line[i];
+                     continue;
+                  }
+                  token.text += line[i];
+               }
+               if (i >= n)
+                  return unsupported(error, "unterminated double quote");
+               i++;
+               is_digits = false;
+               continue;
+            }
+            if (c == '\\')
+            {
+               if (i + 1 >= n)
+                  return unsupported(error, "trailing backslash");
+               if (line[i + 1] != '\n')
+                  token.text += line[i + 1];
+               i += 2;
+               is_digits = false;
+               continue;
+            }
+            if ( (std::strchr(";()$`*?[", c) != nullptr) || ( (i == start) && ( (c == '~') || (c == '#') ) ) )
+               return unsupported(error, std::string(1, c));
+            if (c == '=')
+               token.is_assignment = true;
+            if ( (c < '0') || (c > '9') )
+               is_digits = false;
+            token.text += c;
+            i++;
+         }
+         if ( (is_digits) && (i < n) && ( (line[i] == '<') || (line[i] == '>') ) )
+            return unsupported(error, "redirection of fd " + token.text);
+         token.kind = Token::Kind::word;
+         return true;
+      }
+
+      bool tokenize(std::string_view line, std::vector<Token>& tokens, std::string& error)
+      //----------------------------------------------------------------------------------
+      {
+         std::size_t i = 0, n = line.size();
+         while (i < n)
+         {
+            char c = line[i];
+            if ( (c == ' ') || (c == '\t') )
+            {
+               i++;
+               continue;
+            }
+            if ( (c == '\\') && (i + 1 < n) && (line[i + 1] == '\n') ) // Line continuation between words
+            {
+               i += 2;
+               continue;
+            }
+            if (c == '\n') // A command separator like ;
+               return unsupported(error, "newline");
+            Token token;
+            if (c == '|')
+            {
+               if ( (i + 1 < n) && (line[i + 1] == '|') )
+                  return unsupported(error, "||");
+               token.kind = Token::Kind::pipe;
+               i++;
+            }
+            else if (c == '&')
+            {
+               if ( (i + 1 >= n) || (line[i + 1] != '&') )
+                  return unsupported(error, "&");
+               token.kind = Token::Kind::and_then;
+               i += 2;
+            }
+            else if ( (c == '<') || (c == '>') || ( ( (c == '1') || (c == '2') ) && (i + 1 < n) && (line[i + 1] == '>') ) )
+            {
+               CommandLine::Redirection& redirection = token.redirection;
+               token.kind = Token::Kind::redirect;
+               if (c == '<')
+               {
+                  if ( (i + 1 < n) && ( (line[i + 1] == '<') || (line[i + 1] == '>') || (line[i + 1] == '&') ) )
+                     return unsupported(error, std::string("<") + line[i + 1]);
+                  redirection.fd = STDIN_FILENO;
+                  redirection.flags = O_RDONLY;
+                  i++;
+               }
+               else
+               {
+                  redirection.fd = (c == '2') ? STDERR_FILENO : STDOUT_FILENO;
+                  i += (c == '>') ? 1 : 2;
+                  if ( (i < n) && (line[i] == '>') )
+                  {
+                     redirection.flags = O_WRONLY | O_CREAT | O_APPEND;
+                     i++;
+                  }
+                  else if ( (i < n) && (line[i] == '&') )
+                  {
+                     if ( (redirection.fd != STDERR_FILENO) || (i + 1 >= n) || (line[i + 1] != '1') ||
+                          ( (i + 2 < n) && (std::strchr(" \t\n|&<>", line[i + 2]) == nullptr) ) )
+                        return unsupported(error, "fd duplication other than 2>&1");
+                     redirection.source_fd = STDOUT_FILENO;
+                     i += 2;
+                  }
+                  else if ( (i < n) && (line[i] == '|') )
+                     return unsupported(error, ">|");
+                  else
+                     redirection.flags = O_WRONLY | O_CREAT | O_TRUNC;
+               }
+            }
+            else if (! read_word(line, i, token, error))
+               return false;
+            tokens.push_back(std::move(token));
+         }
+         return true;
+      }
+
+      // eventfd written as each stage of a pipeline completes, kept open while any stage may still write to it
+      struct Completion
+      {
+         int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+         ~Completion() { if (fd >= 0) close(fd); }
+      };
+
+      // Process notifying completion once its status and output have been collected (from the SIGCHLD handler,
+      // so only through the signal safe eventfd write)
+      class Stage : public Process
+      //==========================
+      {
+      public:
+         Stage(const std::string& path, const std::shared_ptr<Completion>& completion)
+            : Process(path), is_done(false), completion(completion) {}
+         std::atomic_bool is_done;
+
+      protected:
+         void on_child_death() override
+         {
+            is_done = true;
+            std::uint64_t one = 1;
+            if (write(completion->fd, &one, sizeof(one)) < 0) {} // Only fails if the counter would overflow
+         }
+
+      private:
+         std::shared_ptr<Completion> completion;
+      };
+
+      int ladder_ms(const TerminationLadder& ladder)
+      //--------------------------------------------
+      {
+         int ms = 0;
+         for (const TerminationStage& stage : ladder)
+            ms += stage.grace_ms;
+         return ms;
+      }
+   }
+
+   bool CommandLine::parse(std::string_view line)
+   //--------------------------------------------
+   {
+      chain.clear();
+      last_error_mess.clear();
+      std::vector<Token> tokens;
+      if (! tokenize(line, tokens, last_error_mess))
+         return false;
+      std::vector<Pipeline> parsed;
+      Pipeline pipeline;
+      Command command;
+      const Redirection* pending = nullptr; // Redirection awaiting its file name
+      for (std::size_t i = 0; i <= tokens.size(); i++)
+      {
+         const Token* token = (i < tokens.size()) ? &tokens[i] : nullptr;
+         if ( (token != nullptr) && (token->kind == Token::Kind::word) )
+         {
+            if (pending != nullptr)
+            {
+               command.redirections.push_back(*pending);
+               command.redirections.back().path = token->text;
+               pending = nullptr;
+            }
+            else
+            {
+               if ( (command.argv.empty()) && ( (token->is_assignment) || (is_shell_word(token->text)) ) )
+                  return unsupported(last_error_mess, token->text);
+               command.argv.push_back(token->text);
+            }
+            continue;
+         }
+         if (pending != nullptr)
+         {
+            last_error_mess = "Syntax error: redirection without a file name";
+            return false;
+         }
+         if ( (token != nullptr) && (token->kind == Token::Kind::redirect) )
+         {
+            if (token->redirection.source_fd >= 0)
+               command.redirections.push_back(token->redirection);
+            else
+               pending = &token->redirection;
+            continue;
+         }
+         if (command.argv.empty()) // Before |, && or the end
+         {
+            if ( (token == nullptr) && (tokens.empty()) )
+               last_error_mess = "Empty command line";
+            else
+               last_error_mess = "Syntax error: missing command";
+            return false;
+         }
+         pipeline.push_back(std::move(command));
+         command = Command();
+         if ( (token == nullptr) || (token->kind == Token::Kind::and_then) )
+         {
+            parsed.push_back(std::move(pipeline));
+            pipeline.clear();
+         }
+      }
+      chain = std::move(parsed);
+      return true;
+   }
+
+   bool CommandLine::run(bool is_capture)
+   //------------------------------------
+   {
+      captured.clear();
+      if (chain.empty())
+      {
+         if (last_error_mess.empty())
+            last_error_mess = "No command line";
+         last_status = -1;
+         return false;
+      }
+      for (const Pipeline& pipeline : chain)
+      {
+         if (! run_pipeline(pipeline, is_capture))
+            return false;
+      }
+      return true;
+   }
+
+   bool CommandLine::run_pipeline(const Pipeline& pipeline, bool is_capture)
+   //-----------------------------------------------------------------------
+   {
+      static constexpr int inherit = -1, capture = -2;
+      std::vector<int> opened; // Parent copies, closed once every command has started
+      std::vector<std::shared_ptr<Stage>> stages;
+      bool is_ok = true;
+      int previous_read = -1;
+      captured.clear();
+      last_error_mess.clear();
+      std::shared_ptr<Completion> completion = std::make_shared<Completion>();
+      if (completion->fd < 0)
+      {
+         last_error_mess = std::string("eventfd: ") + std::strerror(errno);
+         last_status = 1;
+         return false;
+      }
+      for (std::size_t i = 0; ( (is_ok) && (i < pipeline.size()) ); i++)
+      {
+         const Command& command = pipeline[i];
+         int targets[3] = { previous_read, inherit, inherit }; // Parent fd (or inherit/capture) for fds 0-2
+         previous_read = inherit;
+         if (i + 1 < pipeline.size())
+         {
+            int pipes[2];
+            if (pipe2(pipes, O_CLOEXEC) != 0)
+            {
+               last_error_mess = std::string("pipe: ") + std::strerror(errno);
+               is_ok = false;
+               break;
+            }
+            opened.insert(opened.end(), { pipes[0], pipes[1] });
+            targets[STDOUT_FILENO] = pipes[1];
+            previous_read = pipes[0];
+         }
+         else if (is_capture)
+            targets[STDOUT_FILENO] = capture;
+         for (const Redirection& redirection : command.redirections)
+         {
+            if (redirection.source_fd >= 0)
+            {
+               targets[redirection.fd] = targets[redirection.source_fd];
+               continue;
+            }
+            int fd = open(redirection.path.c_str(), redirection.flags | O_CLOEXEC, 0666);
+            if (fd < 0)
+            {
+               last_error_mess = redirection.path + ": " + std::strerror(errno);
+               is_ok = false;
+               break;
+            }
+            opened.push_back(fd);
+            targets[redirection.fd] = fd;
+         }
+         if (! is_ok)
+            break;
+         // A name without a / is only looked up on PATH (Process would prefer one in the current directory)
+         std::string executable = ExecPrefetch::resolve(command.argv[0]);
+         if (executable.empty())
+         {
+            last_error_mess = command.argv[0] + ": command not found";
+            is_ok = false;
+            break;
+         }
+         std::shared_ptr<Stage> stage = std::make_shared<Stage>(executable, completion);
+         if (timeout_ms > 0)
+            stage->set_timeouts(timeout_ms);
+         bool is_stdout = (targets[STDOUT_FILENO] == capture), is_stderr = (targets[STDERR_FILENO] == capture);
+         if ( (is_stdout) && (is_stderr) )
+            stage->set_capture_mode(CaptureMode::merged);
+         if ( (is_stdout) || (is_stderr) )
+            stage->set_background_drain();
+         for (int fd : { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO })
+            if (targets[fd] >= 0) stage->map_fd(targets[fd], fd);
+         std::vector<std::string> args(command.argv.begin() + 1, command.argv.end());
+         if (! stage->async_execute(args, stage, is_stdout, is_stderr))
+         {
+            last_error_mess = command.argv[0] + ": " + stage->last_error_message();
+            is_ok = false;
+            break;
+         }
+         stages.push_back(stage);
+      }
+      for (int fd : opened)
+         close(fd);
+      // Timed out stages are killed through the termination ladder, allow it (and a second) to complete
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+         std::chrono::milliseconds(timeout_ms + ladder_ms(Process::default_termination_ladder) + 1000);
+      for (const std::shared_ptr<Stage>& stage : stages)
+      {
+         while (! stage->is_done)
+         {
+            int wait_ms = -1;
+            if (timeout_ms > 0)
+            {
+               wait_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                          deadline - std::chrono::steady_clock::now()).count());
+               if (wait_ms <= 0)
+               {
+                  last_error_mess = stage->get_filename() + ": not completed after termination";
+                  last_status = 1;
+                  return false;
+               }
+            }
+            struct pollfd pfd = { completion->fd, POLLIN, 0 };
+            std::uint64_t count;
+            if ( (poll(&pfd, 1, wait_ms) > 0) && (read(completion->fd, &count, sizeof(count)) < 0) ) {}
+         }
+         if ( (is_ok) && (stage->timed_out() != Timeout::none) )
+         {
+            last_error_mess = stage->get_filename() + ": timed out";
+            is_ok = false;
+         }
+      }
+      if (! is_ok)
+      {
+         last_status = 1;
+         return false;
+      }
+      const std::shared_ptr<Stage>& last = stages.back();
+      last_status = last->status();
+      if (is_capture)
+         captured = last->raw_output() + last->raw_error();
+      return (last_status == 0);
+   }
+}
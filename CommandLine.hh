@@ -0,0 +1,61 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _b7c04e2d9a1f4e63850d6f2a4c9e17b3
+#define _b7c04e2d9a1f4e63850d6f2a4c9e17b3
+namespace posix_util
+{
+   // Runs command lines in a safe subset of the shell language without /bin/sh: words with '', "" and \ quoting,
+   // pipelines (|), && chains and the redirections <, >, >>, 2>, 2>> and 2>&1 (applied in order). Each command
+   // becomes a Process connected by pipes (see Process::map_fd), saving the fork and exec of a shell. As in a shell,
+   // command names without a / are only looked up on PATH. Anything else a shell would interpret (variables, globs,
+   // ; or newline, ||, &, subshells, assignments ...) is rejected by parse rather than passed through literally.
+   class CommandLine
+   //===============
+   {
+   public:
+      struct Redirection
+      {
+         int fd;              // Child fd redirected
+         std::string path;    // File opened for fd, empty when duplicating
+         int flags;           // open(2) flags for path
+         int source_fd;       // Child fd duplicated onto fd (2>&1) or -1
+      };
+
+      struct Command
+      {
+         std::vector<std::string> argv;
+         std::vector<Redirection> redirections;
+      };
+
+      typedef std::vector<Command> Pipeline;
+
+      CommandLine() = default;
+      explicit CommandLine(std::string_view line) { parse(line); }
+
+      bool parse(std::string_view line);
+      bool is_valid() const { return (! chain.empty()); }
+      // Pipelines joined by &&, each run only if the previous one succeeded
+      const std::vector<Pipeline>& pipelines() const { return chain; }
+      // Runs the pipelines, capturing the (otherwise inherited) output of the last command of the last pipeline
+      // run if is_capture. Returns true if the exit status (of the last command run) is 0.
+      bool run(bool is_capture = false);
+      // Kills (through Process::default_termination_ladder) the commands of a pipeline still running wall_ms
+      // after they started, run then fails. 0 (the default) waits for them indefinitely.
+      void set_timeout(int wall_ms) { timeout_ms = wall_ms; }
+      int status() const { return last_status; }
+      const std::string& output() const { return captured; }
+      const std::string& last_error() const { return last_error_mess; }
+
+   private:
+      bool run_pipeline(const Pipeline& pipeline, bool is_capture);
+
+      std::vector<Pipeline> chain;
+      int last_status = -1;
+      int timeout_ms = 0;
+      std::string captured;
+      std::string last_error_mess;
+   };
+}
+#endif
@@ -0,0 +1,332 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ExecPrefetch.hh"
+
+namespace posix_util
+{
+   namespace
+   {
+      bool read_at(int fd, void* data, std::size_t len, off_t offset)
+      //-------------------------------------------------------------
+      {
+         char* p = static_cast<char*>(data);
+         while (len > 0)
+         {
+            ssize_t count = pread(fd, p, len, offset);
+            if ( (count < 0) && (errno == EINTR) ) continue;
+            if (count <= 0) return false;
+            p += count;
+            len -= static_cast<std::size_t>(count);
+            offset += count;
+         }
+         return true;
+      }
+
+      void split_paths(const std::string& list, const std::string& origin, std::vector<std::string>& dirs)
+      //--------------------------------------------------------------------------------------------------
+      {
+         std::stringstream ss(list);
+         std::string dir;
+         while (std::getline(ss, dir, ':'))
+         {
+            for (const char* token : { "${ORIGIN}", "$ORIGIN" })
+            {
+               std::size_t pos;
+               while ((pos = dir.find(token)) != std::string::npos)
+                  dir.replace(pos, std::strlen(token), origin);
+            }
+            if (! dir.empty())
+               dirs.push_back(dir);
+         }
+      }
+
+      // True if len bytes at offset lie within a file of size bytes
+      bool is_within(std::uint64_t offset, std::uint64_t len, std::uint64_t size)
+      //-------------------------------------------------------------------------
+      {
+         return ( (offset <= size) && (len <= size - offset) );
+      }
+
+      // Program headers and the dynamic section of an ELF file of either class. Sizes are checked against the
+      // file size before anything is allocated for them, so a corrupt header fails instead of allocating.
+      template <typename Ehdr, typename Phdr, typename Dyn>
+      bool parse_elf(int fd, const std::string& path, std::uint64_t size, ExecPrefetch::ElfInfo& info)
+      //---------------------------------------------------------------------------------------------
+      {
+         Ehdr header;
+         if ( (! read_at(fd, &header, sizeof(header), 0)) || (header.e_phentsize != sizeof(Phdr)) ||
+              (! is_within(header.e_phoff, static_cast<std::uint64_t>(header.e_phnum) * sizeof(Phdr), size)) )
+            return false;
+         info.machine = header.e_machine;
+         std::vector<Phdr> segments(header.e_phnum);
+         if (! read_at(fd, segments.data(), segments.size() * sizeof(Phdr), static_cast<off_t>(header.e_phoff)))
+            return false;
+         std::vector<Dyn> dynamic;
+         for (const Phdr& segment : segments)
+         {
+            if ( (segment.p_type == PT_INTERP) && (segment.p_filesz > 1) && (segment.p_filesz < 4096) )
+            {
+               info.interpreter.resize(segment.p_filesz);
+               if (! read_at(fd, info.interpreter.data(), segment.p_filesz, static_cast<off_t>(segment.p_offset)))
+                  return false;
+               info.interpreter.resize(std::strlen(info.interpreter.c_str()));
+            }
+            else if (segment.p_type == PT_DYNAMIC)
+            {
+               if (! is_within(segment.p_offset, segment.p_filesz, size))
+                  return false;
+               dynamic.resize(segment.p_filesz / sizeof(Dyn));
+               if (! read_at(fd, dynamic.data(), dynamic.size() * sizeof(Dyn), static_cast<off_t>(segment.p_offset)))
+                  return false;
+            }
+         }
+         std::uint64_t strtab = 0, strsz = 0;
+         std::vector<std::uint64_t> needed;
+         std::int64_t rpath = -1, runpath = -1;
+         for (const Dyn& entry : dynamic)
+         {
+            if (entry.d_tag == DT_NULL) break;
+            switch (entry.d_tag)
+            {
+               case DT_STRTAB: strtab = entry.d_un.d_ptr; break;
+               case DT_STRSZ: strsz = entry.d_un.d_val; break;
+               case DT_NEEDED: needed.push_back(entry.d_un.d_val); break;
+               case DT_RPATH: rpath = static_cast<std::int64_t>(entry.d_un.d_val); break;
+               case DT_RUNPATH: runpath = static_cast<std::int64_t>(entry.d_un.d_val); break;
+               default: break;
+            }
+         }
+         if ( (strtab == 0) || (strsz == 0) )
+            return true;
+         if (strsz > size)
+            return false;
+         off_t strtab_offset = -1; // DT_STRTAB is an address, map it to the file through the loaded segments
+         for (const Phdr& segment : segments)
+         {
+            if ( (segment.p_type == PT_LOAD) && (strtab >= segment.p_vaddr) &&
+                 (strtab < segment.p_vaddr + segment.p_filesz) )
+               strtab_offset = static_cast<off_t>(strtab - segment.p_vaddr + segment.p_offset);
+         }
+         if ( (strtab_offset >= 0) && (! is_within(static_cast<std::uint64_t>(strtab_offset), strsz, size)) )
+            return false;
+         std::string strings(strsz, '\0');
+         if ( (strtab_offset < 0) || (! read_at(fd, strings.data(), strings.size(), strtab_offset)) )
+            return false;
+         auto string_at = [&strings](std::uint64_t offset)
+         {
+            return (offset < strings.size()) ? std::string(strings.c_str() + offset) : std::string();
+         };
+         for (std::uint64_t offset : needed)
+            info.needed.push_back(string_at(offset));
+         std::string origin = std::filesystem::path(path).parent_path().string();
+         info.is_runpath = (runpath >= 0);
+         if ( (runpath >= 0) || (rpath >= 0) )
+            split_paths(string_at(static_cast<std::uint64_t>((runpath >= 0) ? runpath : rpath)), origin, info.search);
+         return true;
+      }
+
+      const std::vector<std::string>& system_dirs()
+      //-------------------------------------------
+      {
+         static const std::vector<std::string> dirs = []()
+         {
+            std::vector<std::string> found;
+            std::error_code ec;
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator("/etc/ld.so.conf.d", ec))
+            {
+               if (entry.path().extension() != ".conf") continue;
+               std::ifstream ifs(entry.path());
+               std::string line;
+               while (std::getline(ifs, line))
+               {
+                  if ( (! line.empty()) && (line[0] == '/') )
+                     found.push_back(line.substr(0, line.find_last_not_of(" \t") + 1));
+               }
+            }
+#if defined(__x86_64__)
+            const char* triplet = "x86_64-linux-gnu";
+#elif defined(__aarch64__)
+            const char* triplet = "aarch64-linux-gnu";
+#else
+            const char* triplet = nullptr;
+#endif
+            if (triplet != nullptr)
+            {
+               found.push_back(std::string("/lib/") + triplet);
+               found.push_back(std::string("/usr/lib/") + triplet);
+            }
+            for (const char* dir : { "/lib64", "/usr/lib64", "/lib", "/usr/lib" })
+               found.push_back(dir);
+            return found;
+         }();
+         return dirs;
+      }
+   }
+
+   std::string ExecPrefetch::resolve(const std::string& command)
+   //-----------------------------------------------------------
+   {
+      if (command.find('/') != std::string::npos)
+         return (access(command.c_str(), X_OK) == 0) ? command : std::string();
+      const char* path = getenv("PATH");
+      std::vector<std::string> dirs;
+      split_paths((path != nullptr) ? path : "/usr/local/bin:/usr/bin:/bin", ".", dirs);
+      for (const std::string& dir : dirs)
+      {
+         std::string candidate = dir + "/" + command;
+         struct stat st;
+         if ( (stat(candidate.c_str(), &st) == 0) && (S_ISREG(st.st_mode)) && (access(candidate.c_str(), X_OK) == 0) )
+            return candidate;
+      }
+      return std::string();
+   }
+
+   bool ExecPrefetch::read_elf(const std::string& path, ElfInfo& info)
+   //-----------------------------------------------------------------
+   {
+      info = ElfInfo();
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+         return false;
+      unsigned char ident[EI_NIDENT];
+      struct stat st;
+      bool is_ok = ( (fstat(fd, &st) == 0) && (read_at(fd, ident, sizeof(ident), 0)) &&
+                     (std::memcmp(ident, ELFMAG, SELFMAG) == 0) );
+      if (is_ok)
+      {
+         std::uint64_t size = static_cast<std::uint64_t>(st.st_size);
+         info.elf_class = ident[EI_CLASS];
+         if (info.elf_class == ELFCLASS64)
+            is_ok = parse_elf<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(fd, path, size, info);
+         else if (info.elf_class == ELFCLASS32)
+            is_ok = parse_elf<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(fd, path, size, info);
+         else
+            is_ok = false;
+      }
+      close(fd);
+      return is_ok;
+   }
+
+   // Follows the dynamic loader's search order, skipping objects for another class or machine. Without a
+   // DT_RUNPATH the requester's DT_RPATH is searched followed by loader_rpath, the DT_RPATH of the objects which
+   // loaded it up to the executable.
+   std::string ExecPrefetch::locate(const std::string& library, const ElfInfo& requester,
+                                    const std::vector<std::string>& loader_rpath, ElfInfo& info)
+   //----------------------------------------------------------------------------------------
+   {
+      std::vector<std::string> candidates;
+      if (library.find('/') != std::string::npos)
+         candidates.push_back(library);
+      else
+      {
+         std::vector<std::string> dirs;
+         if (! requester.is_runpath)
+         {
+            dirs = requester.search;
+            dirs.insert(dirs.end(), loader_rpath.begin(), loader_rpath.end());
+         }
+         const char* ld_path = getenv("LD_LIBRARY_PATH");
+         if (ld_path != nullptr)
+            split_paths(ld_path, ".", dirs);
+         if (requester.is_runpath)
+            dirs.insert(dirs.end(), requester.search.begin(), requester.search.end());
+         dirs.insert(dirs.end(), system_dirs().begin(), system_dirs().end());
+         for (const std::string& dir : dirs)
+            candidates.push_back(dir + "/" + library);
+      }
+      for (const std::string& candidate : candidates)
+      {
+         if ( (access(candidate.c_str(), R_OK) == 0) && (read_elf(candidate, info)) &&
+              (info.elf_class == requester.elf_class) && (info.machine == requester.machine) )
+            return candidate;
+      }
+      return std::string();
+   }
+
+   bool ExecPrefetch::readahead_file(const std::string& path, std::size_t& bytes)
+   //----------------------------------------------------------------------------
+   {
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+         return false;
+      struct stat st;
+      bool is_ok = (fstat(fd, &st) == 0);
+      if (is_ok)
+      {
+         std::size_t size = static_cast<std::size_t>(st.st_size);
+         if (readahead(fd, 0, size) != 0) // Not supported by the file system
+            is_ok = (posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0);
+         if (is_ok)
+            bytes += size;
+      }
+      close(fd);
+      return is_ok;
+   }
+
+   bool ExecPrefetch::prefetch(const std::string& command, Result* result)
+   //---------------------------------------------------------------------
+   {
+      Result local;
+      Result& out = (result != nullptr) ? *result : local;
+      out = Result();
+      std::string executable = resolve(command);
+      ElfInfo info;
+      if ( (executable.empty()) || (! readahead_file(executable, out.bytes)) )
+         return false;
+      out.files.push_back(executable);
+      if (! read_elf(executable, info)) // Eg a script, only the file itself is warmed
+         return true;
+      std::set<std::string> seen = { executable };
+      // Objects whose DT_NEEDED remain to be visited with the DT_RPATH of the objects which loaded them
+      std::vector<std::pair<ElfInfo, std::vector<std::string>>> pending;
+      if (! info.interpreter.empty())
+      {
+         ElfInfo interpreter;
+         if ( (seen.insert(info.interpreter).second) && (read_elf(info.interpreter, interpreter)) &&
+              (readahead_file(info.interpreter, out.bytes)) )
+            out.files.push_back(info.interpreter);
+      }
+      pending.emplace_back(info, std::vector<std::string>());
+      std::set<std::string> visited_names;
+      while (! pending.empty())
+      {
+         ElfInfo requester = std::move(pending.back().first);
+         std::vector<std::string> loader_rpath = std::move(pending.back().second);
+         pending.pop_back();
+         std::vector<std::string> chain_rpath; // Inherited by the objects requester loads
+         if (! requester.is_runpath)
+            chain_rpath = requester.search;
+         chain_rpath.insert(chain_rpath.end(), loader_rpath.begin(), loader_rpath.end());
+         for (const std::string& library : requester.needed)
+         {
+            if (! visited_names.insert(library).second)
+               continue;
+            ElfInfo library_info;
+            std::string path = locate(library, requester, loader_rpath, library_info);
+            if (path.empty())
+            {
+               out.missing.push_back(library);
+               continue;
+            }
+            if (! seen.insert(path).second)
+               continue;
+            if (readahead_file(path, out.bytes))
+               out.files.push_back(path);
+            pending.emplace_back(std::move(library_info), chain_rpath);
+         }
+      }
+      return true;
+   }
+}
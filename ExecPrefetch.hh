@@ -0,0 +1,46 @@
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifndef _2c8f6a0d4e1b47a9b35e7d9c0f8a1e64
+#define _2c8f6a0d4e1b47a9b35e7d9c0f8a1e64
+namespace posix_util
+{
+   // Warms the page cache for an executable and the shared objects the dynamic loader will map for it (PT_INTERP
+   // and the DT_NEEDED closure, located via DT_RPATH/DT_RUNPATH, LD_LIBRARY_PATH, /etc/ld.so.conf.d and the
+   // default directories) with readahead, so a burst of spawns after cache pressure does not wait on disk.
+   // Libraries loaded with dlopen are not seen.
+   class ExecPrefetch
+   //================
+   {
+   public:
+      struct ElfInfo
+      {
+         std::string interpreter;          // PT_INTERP, empty for static executables
+         std::vector<std::string> needed;  // DT_NEEDED
+         std::vector<std::string> search;  // DT_RUNPATH (or DT_RPATH) directories with $ORIGIN expanded
+         bool is_runpath = false;
+         unsigned char elf_class = 0;      // ELFCLASS32 or ELFCLASS64
+         unsigned short machine = 0;       // e_machine
+      };
+
+      struct Result
+      {
+         std::vector<std::string> files;   // Prefetched, executable first
+         std::vector<std::string> missing; // DT_NEEDED entries which could not be located
+         std::size_t bytes = 0;
+      };
+
+      // Resolves command (searching PATH if it contains no /) and prefetches it and its dependencies, returning
+      // false if the executable itself could not be resolved or read
+      static bool prefetch(const std::string& command, Result* result = nullptr);
+      static std::string resolve(const std::string& command);
+      static bool read_elf(const std::string& path, ElfInfo& info);
+
+   private:
+      static std::string locate(const std::string& library, const ElfInfo& requester,
+                                const std::vector<std::string>& loader_rpath, ElfInfo& info);
+      static bool readahead_file(const std::string& path, std::size_t& bytes);
+   };
+}
+#endif
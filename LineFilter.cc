@@ -0,0 +1,84 @@
+#include <queue>
+
+#include "LineFilter.hh"
+
+namespace posix_util
+{
+   LineFilter::LineFilter(const std::vector<std::string>& literals, const std::string& regex, bool is_invert)
+   //-------------------------------------------------------------------------------------------------------
+      : has_literals(false), has_regex(! regex.empty()), invert(is_invert)
+   {
+      build(literals);
+      if (has_regex)
+         pattern = std::regex(regex, std::regex::ECMAScript | std::regex::optimize);
+   }
+
+   // Builds the goto trie then resolves failure links breadth first into a complete transition table so
+   // matching is a single table lookup per byte.
+   void LineFilter::build(const std::vector<std::string>& literals)
+   //--------------------------------------------------------------
+   {
+      transitions.assign(1, std::array<std::uint32_t, 256>());
+      transitions[0].fill(0);
+      accepting.assign(1, false);
+      for (const std::string& literal : literals)
+      {
+         if (literal.empty()) continue;
+         has_literals = true;
+         std::uint32_t state = 0;
+         for (unsigned char c : literal)
+         {
+            if (transitions[state][c] == 0)
+            {
+               transitions[state][c] = static_cast<std::uint32_t>(transitions.size());
+               transitions.emplace_back();
+               transitions.back().fill(0);
+               accepting.push_back(false);
+            }
+            state = transitions[state][c];
+         }
+         accepting[state] = true;
+      }
+      std::vector<std::uint32_t> failure(transitions.size(), 0);
+      std::queue<std::uint32_t> pending;
+      for (int c=0; c<256; c++)
+         if (transitions[0][c] != 0)
+            pending.push(transitions[0][c]);
+      while (! pending.empty())
+      {
+         std::uint32_t state = pending.front();
+         pending.pop();
+         if (accepting[failure[state]])
+            accepting[state] = true;
+         for (int c=0; c<256; c++)
+         {
+            std::uint32_t next = transitions[state][c];
+            if (next != 0)
+            {
+               failure[next] = transitions[failure[state]][c];
+               pending.push(next);
+            }
+            else
+               transitions[state][c] = transitions[failure[state]][c];
+         }
+      }
+   }
+
+   bool LineFilter::matches(std::string_view line) const
+   //---------------------------------------------------
+   {
+      if (has_literals)
+      {
+         std::uint32_t state = 0;
+         for (unsigned char c : line)
+         {
+            state = transitions[state][c];
+            if (accepting[state])
+               return true;
+         }
+      }
+      if (has_regex)
+         return std::regex_search(line.begin(), line.end(), pattern);
+      return false;
+   }
+}
@@ -0,0 +1,35 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _7b3d5e91c2a04f68a1d9e0c4b6f2a835
+#define _7b3d5e91c2a04f68a1d9e0c4b6f2a835
+namespace posix_util
+{
+   // Precompiled line predicate for capture time filtering (see Process::set_line_filter). A line matches if it
+   // contains any of the literal patterns (matched in a single pass by an Aho-Corasick automaton) or matches the
+   // optional ECMAScript regex (searched, not anchored). If is_invert then lines which do not match are kept.
+   class LineFilter
+   //==============
+   {
+   public:
+      explicit LineFilter(const std::vector<std::string>& literals, const std::string& regex = "",
+                          bool is_invert = false);
+
+      bool matches(std::string_view line) const;
+      bool operator()(std::string_view line) const { return (matches(line) != invert); }
+
+   private:
+      std::vector<std::array<std::uint32_t, 256>> transitions; // Complete DFA, state 0 is the root
+      std::vector<bool> accepting;
+      bool has_literals, has_regex, invert;
+      std::regex pattern;
+
+      void build(const std::vector<std::string>& literals);
+   };
+}
+#endif
@@ -0,0 +1,208 @@
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINESPLITTER_X86
+#endif
+
+#include "LineSplitter.hh"
+
+namespace posix_util
+{
+   std::size_t LineSplitter::parallel_threshold = 16 * 1024 * 1024;
+   unsigned int LineSplitter::parallel_threads = 0;
+
+   namespace
+   {
+      struct Table
+      {
+         bool is_member[256];
+         explicit Table(std::string_view chars)
+         {
+            std::memset(is_member, 0, sizeof(is_member));
+            for (char ch : chars)
+               is_member[static_cast<unsigned char>(ch)] = true;
+         }
+      };
+
+      inline std::string_view trim_view(std::string_view s, const bool* table)
+      //----------------------------------------------------------------------
+      {
+         std::size_t b = 0, e = s.size();
+         while ( (b < e) && (table[static_cast<unsigned char>(s[b])]) ) b++;
+         while ( (e > b) && (table[static_cast<unsigned char>(s[e - 1])]) ) e--;
+         return s.substr(b, e - b);
+      }
+
+      // Calls emit for each token given the delimiter positions in a block (bit i set => p[i] is a delimiter)
+      struct Emitter
+      {
+         const char* base;
+         std::size_t start;
+         bool is_trim;
+         const bool* trim_table;
+         std::vector<std::string_view>& tokens;
+
+         inline void delimiter(std::size_t pos)
+         {
+            if (pos > start)
+            {
+               std::string_view token(base + start, pos - start);
+               tokens.emplace_back((is_trim) ? trim_view(token, trim_table) : token);
+            }
+            start = pos + 1;
+         }
+
+         inline void block(std::uint64_t mask, std::size_t offset)
+         {
+            while (mask != 0)
+            {
+               delimiter(offset + static_cast<std::size_t>(__builtin_ctzll(mask)));
+               mask &= mask - 1;
+            }
+         }
+      };
+
+#ifdef LINESPLITTER_X86
+      inline std::uint32_t sse2_mask(const char* p, const __m128i* delims, std::size_t ndelims)
+      //----------------------------------------------------------------------------------------
+      {
+         __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+         __m128i eq = _mm_cmpeq_epi8(block, delims[0]);
+         for (std::size_t i=1; i<ndelims; i++)
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(block, delims[i]));
+         return static_cast<std::uint32_t>(_mm_movemask_epi8(eq));
+      }
+
+      std::size_t scan_sse2(const char* p, std::size_t i, std::size_t len, std::string_view delim, Emitter& emitter)
+      //-----------------------------------------------------------------------------------------------------------
+      {
+         __m128i delims[LineSplitter::max_simd_delimiters];
+         for (std::size_t d=0; d<delim.size(); d++)
+            delims[d] = _mm_set1_epi8(delim[d]);
+         for (; i + 64 <= len; i += 64)
+         {
+            std::uint64_t mask = static_cast<std::uint64_t>(sse2_mask(p + i, delims, delim.size())) |
+                                 (static_cast<std::uint64_t>(sse2_mask(p + i + 16, delims, delim.size())) << 16) |
+                                 (static_cast<std::uint64_t>(sse2_mask(p + i + 32, delims, delim.size())) << 32) |
+                                 (static_cast<std::uint64_t>(sse2_mask(p + i + 48, delims, delim.size())) << 48);
+            emitter.block(mask, i);
+         }
+         for (; i + 16 <= len; i += 16)
+            emitter.block(sse2_mask(p + i, delims, delim.size()), i);
+         return i;
+      }
+
+      __attribute__((target("avx2")))
+      std::size_t scan_avx2(const char* p, std::size_t i, std::size_t len, std::string_view delim, Emitter& emitter)
+      //-----------------------------------------------------------------------------------------------------------
+      {
+         __m256i delims[LineSplitter::max_simd_delimiters];
+         for (std::size_t d=0; d<delim.size(); d++)
+            delims[d] = _mm256_set1_epi8(delim[d]);
+         for (; i + 64 <= len; i += 64)
+         {
+            __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 32));
+            __m256i eqlo = _mm256_cmpeq_epi8(lo, delims[0]), eqhi = _mm256_cmpeq_epi8(hi, delims[0]);
+            for (std::size_t d=1; d<delim.size(); d++)
+            {
+               eqlo = _mm256_or_si256(eqlo, _mm256_cmpeq_epi8(lo, delims[d]));
+               eqhi = _mm256_or_si256(eqhi, _mm256_cmpeq_epi8(hi, delims[d]));
+            }
+            std::uint64_t mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(eqlo)) |
+                                 (static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(eqhi))) << 32);
+            emitter.block(mask, i);
+         }
+         return i;
+      }
+
+      bool has_avx2()
+      //-------------
+      {
+         static const bool is_avx2 = __builtin_cpu_supports("avx2");
+         return is_avx2;
+      }
+#endif
+   }
+
+   const char* LineSplitter::simd_level()
+   //------------------------------------
+   {
+#ifdef LINESPLITTER_X86
+      return (has_avx2()) ? "avx2" : "sse2";
+#else
+      return "scalar";
+#endif
+   }
+
+   std::string_view LineSplitter::trim(std::string_view s, std::string_view chars)
+   //-----------------------------------------------------------------------------
+   {
+      Table table(chars);
+      return trim_view(s, table.is_member);
+   }
+
+   void LineSplitter::split_range(std::string_view s, std::vector<std::string_view>& tokens, std::string_view delim,
+                                  bool is_trim, const bool* trim_table)
+   //-------------------------------------------------------------------------------------------------------------
+   {
+      Emitter emitter{s.data(), 0, is_trim, trim_table, tokens};
+      std::size_t i = 0;
+#ifdef LINESPLITTER_X86
+      if ( (! delim.empty()) && (delim.size() <= max_simd_delimiters) )
+      {
+         if (has_avx2())
+            i = scan_avx2(s.data(), i, s.size(), delim, emitter);
+         i = scan_sse2(s.data(), i, s.size(), delim, emitter);
+      }
+#endif
+      Table delim_table(delim);
+      for (; i < s.size(); i++)
+         if (delim_table.is_member[static_cast<unsigned char>(s[i])])
+            emitter.delimiter(i);
+      emitter.delimiter(s.size());
+   }
+
+   std::size_t LineSplitter::split(std::string_view s, std::vector<std::string_view>& tokens, std::string_view delim,
+                                   bool is_trim, std::string_view trim_chars)
+   //-----------------------------------------------------------------------------------------------------------
+   {
+      tokens.clear();
+      Table trim_table(trim_chars);
+      unsigned int nthreads = (parallel_threads > 0) ? parallel_threads : std::thread::hardware_concurrency();
+      if ( (s.size() < parallel_threshold) || (nthreads < 2) || (delim.empty()) )
+      {
+         split_range(s, tokens, delim, is_trim, trim_table.is_member);
+         return tokens.size();
+      }
+      // Chunk boundaries are moved forward to just after a delimiter so no token straddles two chunks
+      Table delim_table(delim);
+      std::vector<std::string_view> chunks;
+      std::size_t chunk_size = s.size() / nthreads, start = 0;
+      while (start < s.size())
+      {
+         std::size_t end = std::min(start + chunk_size, s.size());
+         while ( (end < s.size()) && (! delim_table.is_member[static_cast<unsigned char>(s[end])]) ) end++;
+         if (end < s.size()) end++;
+         chunks.push_back(s.substr(start, end - start));
+         start = end;
+      }
+      std::vector<std::vector<std::string_view>> results(chunks.size());
+      std::vector<std::thread> threads;
+      for (std::size_t c=1; c<chunks.size(); c++)
+         threads.emplace_back([&, c]() { split_range(chunks[c], results[c], delim, is_trim, trim_table.is_member); });
+      split_range(chunks[0], results[0], delim, is_trim, trim_table.is_member);
+      for (std::thread& t : threads)
+         t.join();
+      std::size_t total = 0;
+      for (const auto& r : results) total += r.size();
+      tokens.reserve(total);
+      for (const auto& r : results)
+         tokens.insert(tokens.end(), r.begin(), r.end());
+      return tokens.size();
+   }
+}
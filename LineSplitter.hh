@@ -0,0 +1,31 @@
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#ifndef _5c8a1f3e9d2b47a0b6e4c7d1f2a9e083
+#define _5c8a1f3e9d2b47a0b6e4c7d1f2a9e083
+namespace posix_util
+{
+   // Splits text into string_view tokens separated by one or more delimiter characters (empty tokens are
+   // skipped, as with Process::split). Delimiters are located 16 (SSE2) or 32 (AVX2, when the CPU supports it)
+   // bytes at a time when there are at most max_simd_delimiters of them, otherwise through a lookup table.
+   // Inputs larger than parallel_threshold are divided at delimiter boundaries and split on multiple threads.
+   class LineSplitter
+   //================
+   {
+   public:
+      static std::size_t split(std::string_view s, std::vector<std::string_view>& tokens,
+                               std::string_view delim = "\n", bool is_trim = true, std::string_view trim_chars = " \t");
+      static std::string_view trim(std::string_view s, std::string_view chars = " \t");
+      static const char* simd_level();
+
+      static std::size_t parallel_threshold;
+      static unsigned int parallel_threads; // 0 for std::thread::hardware_concurrency()
+      static constexpr std::size_t max_simd_delimiters = 4;
+
+   private:
+      static void split_range(std::string_view s, std::vector<std::string_view>& tokens, std::string_view delim,
+                              bool is_trim, const bool* trim_table);
+   };
+}
+#endif
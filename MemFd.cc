@@ -0,0 +1,143 @@
+#include <cerrno>
+#include <cstdio>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "MemFd.hh"
+
+#ifndef MFD_EXEC
+#define MFD_EXEC 0x0010U
+#endif
+
+namespace posix_util
+{
+   MemFd::MemFd(const char* nme, bool is_cloexec) : name(nme), memfd(-1), cloexec(is_cloexec), sealed(false),
+                                                     mapped(nullptr), mapped_len(0), last_err(0)
+   //---------------------------------------------------------------------------------------------------------
+   {
+   }
+
+   MemFd::~MemFd() { close(); }
+
+   bool MemFd::create(bool is_executable)
+   //------------------------------------
+   {
+      unsigned int flags = MFD_ALLOW_SEALING;
+      if (cloexec) flags |= MFD_CLOEXEC;
+      memfd = -1;
+      if (is_executable) // kernels >= 6.3 honour vm.memfd_noexec, older ones reject the flag with EINVAL
+         memfd = memfd_create(name.c_str(), flags | MFD_EXEC);
+      if (memfd < 0)
+         memfd = memfd_create(name.c_str(), flags);
+      if (memfd < 0)
+      {
+         last_err = errno;
+         perror("memfd_create");
+         return false;
+      }
+      sealed = false;
+      return true;
+   }
+
+   bool MemFd::write(const void* data, std::size_t len)
+   //--------------------------------------------------
+   {
+      const char* p = static_cast<const char*>(data);
+      while (len > 0)
+      {
+         ssize_t count = ::write(memfd, p, len);
+         if (count < 0)
+         {
+            if (errno == EINTR) continue;
+            last_err = errno;
+            perror("write (memfd)");
+            return false;
+         }
+         p += count;
+         len -= count;
+      }
+      return true;
+   }
+
+   bool MemFd::resize(std::size_t len)
+   //---------------------------------
+   {
+      if (ftruncate(memfd, static_cast<off_t>(len)) != 0)
+      {
+         last_err = errno;
+         perror("ftruncate (memfd)");
+         return false;
+      }
+      return true;
+   }
+
+   void* MemFd::map(std::size_t len, bool is_writable)
+   //-------------------------------------------------
+   {
+      unmap();
+      if (len == 0) len = size();
+      if (len == 0) return nullptr;
+      int prot = PROT_READ | ((is_writable) ? PROT_WRITE : 0);
+      void* p = mmap(nullptr, len, prot, MAP_SHARED, memfd, 0);
+      if (p == MAP_FAILED)
+      {
+         last_err = errno;
+         perror("mmap (memfd)");
+         return nullptr;
+      }
+      mapped = p;
+      mapped_len = len;
+      return mapped;
+   }
+
+   void MemFd::unmap()
+   //-----------------
+   {
+      if (mapped != nullptr)
+         munmap(mapped, mapped_len);
+      mapped = nullptr;
+      mapped_len = 0;
+   }
+
+   bool MemFd::seal()
+   //----------------
+   {
+      // A shared writable mapping prevents F_SEAL_WRITE so drop it first
+      unmap();
+      if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+      {
+         last_err = errno;
+         perror("fcntl F_ADD_SEALS");
+         return false;
+      }
+      sealed = true;
+      return true;
+   }
+
+   bool MemFd::close()
+   //-----------------
+   {
+      unmap();
+      if (memfd < 0) return true;
+      int ret = ::close(memfd);
+      memfd = -1;
+      if (ret != 0)
+      {
+         last_err = errno;
+         return false;
+      }
+      return true;
+   }
+
+   std::size_t MemFd::size() const
+   //-----------------------------
+   {
+      struct stat st;
+      if ( (memfd < 0) || (fstat(memfd, &st) != 0) )
+         return 0;
+      return static_cast<std::size_t>(st.st_size);
+   }
+}
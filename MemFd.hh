@@ -0,0 +1,42 @@
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+
+#ifndef _3f1e0c9a7b2d4e58a6c1d0b9e47f2a13
+#define _3f1e0c9a7b2d4e58a6c1d0b9e47f2a13
+namespace posix_util
+{
+   class MemFd
+   //=========
+   {
+   public:
+      explicit MemFd(const char* name, bool is_cloexec = true);
+      ~MemFd();
+      MemFd(const MemFd& other) = delete;
+      MemFd& operator=(const MemFd& other) = delete;
+
+      bool create(bool is_executable = false);
+      bool write(const void* data, std::size_t len);
+      bool resize(std::size_t len);
+      void* map(std::size_t len = 0, bool is_writable = false);
+      void unmap();
+      bool seal();
+      bool close();
+      int fd() const { return memfd; }
+      std::size_t size() const;
+      void* address() const { return mapped; }
+      std::size_t mapped_size() const { return mapped_len; }
+      bool is_sealed() const { return sealed; }
+      int last_error() const { return last_err; }
+
+   private:
+      std::string name;
+      int memfd;
+      bool cloexec, sealed;
+      void* mapped;
+      std::size_t mapped_len;
+      int last_err;
+   };
+}
+#endif
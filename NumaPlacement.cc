@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+#include <sched.h>
+
+#include "NumaPlacement.hh"
+
+namespace posix_util
+{
+   NumaPlacement& NumaPlacement::instance()
+   //--------------------------------------
+   {
+      static NumaPlacement placement("/sys/devices/system/node");
+      return placement;
+   }
+
+   NumaPlacement::NumaPlacement(const std::string& sysfs_root)
+   //---------------------------------------------------------
+   {
+      cpu_set_t allowed;
+      CPU_ZERO(&allowed);
+      bool is_allowed_known = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+      std::error_code ec;
+      for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(sysfs_root, ec))
+      {
+         std::string name = entry.path().filename().string();
+         if ( (name.size() < 5) || (name.compare(0, 4, "node") != 0) ||
+              (name.find_first_not_of("0123456789", 4) != std::string::npos) )
+            continue;
+         std::ifstream ifs(entry.path() / "cpulist");
+         std::string list;
+         std::getline(ifs, list);
+         Node node = { std::atoi(name.c_str() + 4), {} };
+         for (int cpu : parse_cpulist(list))
+         {
+            if ( (! is_allowed_known) || ( (cpu < CPU_SETSIZE) && (CPU_ISSET(cpu, &allowed)) ) )
+               node.cpus.push_back(cpu);
+         }
+         if (! node.cpus.empty()) // Memory only nodes or CPUs outside our cpuset
+            topology.push_back(std::move(node));
+      }
+      std::sort(topology.begin(), topology.end(), [](const Node& a, const Node& b) { return (a.id < b.id); });
+      counts = std::make_unique<std::atomic<std::size_t>[]>(std::max<std::size_t>(topology.size(), 1));
+      for (std::size_t i = 0; i < std::max<std::size_t>(topology.size(), 1); i++)
+         counts[i] = 0;
+   }
+
+   int NumaPlacement::acquire()
+   //--------------------------
+   {
+      if (topology.size() < 2)
+         return -1;
+      std::size_t best = 0;
+      for (std::size_t i = 1; i < topology.size(); i++)
+         if (live(i) < live(best)) best = i;
+      counts[best]++;
+      return static_cast<int>(best);
+   }
+
+   void NumaPlacement::release(int index)
+   //------------------------------------
+   {
+      if ( (index >= 0) && (static_cast<std::size_t>(index) < topology.size()) && (counts[index].load() > 0) )
+         counts[index]--;
+   }
+
+   // Parses the sysfs cpulist format eg 0-3,8-11
+   std::vector<int> NumaPlacement::parse_cpulist(const std::string& list)
+   //--------------------------------------------------------------------
+   {
+      std::vector<int> cpus;
+      std::size_t pos = 0;
+      while (pos < list.size())
+      {
+         std::size_t end = list.find(',', pos);
+         if (end == std::string::npos)
+            end = list.size();
+         std::string range = list.substr(pos, end - pos);
+         pos = end + 1;
+         if (range.find_first_of("0123456789") == std::string::npos)
+            continue;
+         std::size_t dash = range.find('-');
+         int first = std::atoi(range.c_str());
+         int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+         for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+      }
+      return cpus;
+   }
+}
@@ -0,0 +1,46 @@
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _9e3d5b71c2a84f06b8d4a1e6f0c27d95
+#define _9e3d5b71c2a84f06b8d4a1e6f0c27d95
+namespace posix_util
+{
+   // NUMA topology (nodes with CPUs the process may use, read from sysfs) and the number of live children placed
+   // on each node, for Process::set_numa_spread. acquire picks the node with the fewest live children; on single
+   // node machines (or without sysfs) there is nothing to spread over and it returns -1 so children are left
+   // unbound.
+   class NumaPlacement
+   //=================
+   {
+   public:
+      struct Node
+      {
+         int id;
+         std::vector<int> cpus;
+      };
+
+      static NumaPlacement& instance();
+      // Reads the topology below sysfs_root (eg a copy of /sys/devices/system/node)
+      explicit NumaPlacement(const std::string& sysfs_root);
+      NumaPlacement(const NumaPlacement& other) = delete;
+      NumaPlacement& operator=(const NumaPlacement& other) = delete;
+
+      std::size_t nodes() const { return topology.size(); }
+      const Node& node(std::size_t index) const { return topology[index]; }
+      // Index of the least loaded node with its live count incremented, -1 if there are fewer than two nodes
+      int acquire();
+      // Signal safe (called when a child is reaped)
+      void release(int index);
+      std::size_t live(std::size_t index) const { return counts[index].load(std::memory_order_relaxed); }
+
+      static std::vector<int> parse_cpulist(const std::string& list);
+
+   private:
+      std::vector<Node> topology;
+      std::unique_ptr<std::atomic<std::size_t>[]> counts;
+   };
+}
+#endif
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "OutputDrainer.hh"
+#include "Process.hh"
+#include "CaptureBudget.hh"
+
+namespace posix_util
+{
+   OutputDrainer& OutputDrainer::instance()
+   //--------------------------------------
+   {
+      static OutputDrainer drainer;
+      return drainer;
+   }
+
+   OutputDrainer::OutputDrainer() : next_token(2) // 0 = stop, 1 = CaptureBudget released
+   //--------------------------------------------
+   {
+      epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd < 0)
+         perror("epoll_create1 (OutputDrainer)");
+      wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (wake_fd < 0)
+         perror("eventfd (OutputDrainer)");
+      struct epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.u64 = 0;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) != 0)
+         perror("epoll_ctl (OutputDrainer wake)");
+      ev.data.u64 = 1;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, CaptureBudget::instance().release_fd(), &ev) != 0)
+         perror("epoll_ctl (OutputDrainer budget)");
+      worker = std::thread(&OutputDrainer::run, this);
+   }
+
+   OutputDrainer::~OutputDrainer()
+   //-----------------------------
+   {
+      std::uint64_t one = 1;
+      if (write(wake_fd, &one, sizeof(one)) < 0)
+         perror("write (OutputDrainer wake)");
+      if (worker.joinable())
+         worker.join();
+      close(epoll_fd);
+      close(wake_fd);
+   }
+
+   bool OutputDrainer::watch(const std::shared_ptr<Process>& process)
+   //----------------------------------------------------------------
+   {
+      if ( (! process) || (epoll_fd < 0) )
+         return false;
+      std::lock_guard<std::mutex> lock(mtx);
+      for (int stream : { STDOUT_FILENO, STDERR_FILENO, Process::side_channel_stream })
+      {
+         int fd = process->stream_pipe(stream);
+         if (fd < 0) continue;
+         int flags = fcntl(fd, F_GETFL);
+         if (flags >= 0)
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+         std::uint64_t token = next_token++;
+         entries[token] = Entry{process, stream, fd, false, false, std::chrono::steady_clock::time_point()};
+         struct epoll_event ev{};
+         ev.events = EPOLLIN;
+         ev.data.u64 = token;
+         if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+         {
+            perror("epoll_ctl (OutputDrainer)");
+            entries.erase(token);
+            return false;
+         }
+      }
+      return true;
+   }
+
+   std::size_t OutputDrainer::watched() { std::lock_guard<std::mutex> lock(mtx); return entries.size(); }
+
+   // Called with mtx held
+   void OutputDrainer::unwatch(std::uint64_t token, int fd)
+   //------------------------------------------------------
+   {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+      auto it = entries.find(token);
+      if ( (it != entries.end()) && (it->second.is_throttled) )
+         CaptureBudget::instance().throttle_ended(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - it->second.throttled_at).count());
+      entries.erase(token);
+   }
+
+   // Stops reading a pipe (leaving it registered without events) so the pipe buffer fills and blocks the child
+   void OutputDrainer::throttle(std::uint64_t token)
+   //-----------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = entries.find(token);
+      if ( (it == entries.end()) || (it->second.is_throttled) )
+         return;
+      struct epoll_event ev{};
+      ev.events = 0;
+      ev.data.u64 = token;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, it->second.fd, &ev) != 0)
+         return;
+      it->second.is_throttled = true;
+      it->second.throttled_at = std::chrono::steady_clock::now();
+      CaptureBudget::instance().throttle_started();
+   }
+
+   // Resumes reading throttled pipes, either all of them (memory released) or those throttled for longer than
+   // CaptureBudget::max_throttle_ms
+   void OutputDrainer::resume(bool is_overdue_only)
+   //----------------------------------------------
+   {
+      if (! is_overdue_only)
+      {
+         std::uint64_t count;
+         if (read(CaptureBudget::instance().release_fd(), &count, sizeof(count)) < 0) {}
+      }
+      std::lock_guard<std::mutex> lock(mtx);
+      auto now = std::chrono::steady_clock::now();
+      auto max_throttle = std::chrono::milliseconds(CaptureBudget::instance().max_throttle_ms());
+      for (auto& [token, entry] : entries)
+      {
+         if (! entry.is_throttled) continue;
+         if ( (is_overdue_only) && ( (max_throttle.count() == 0) || (now - entry.throttled_at < max_throttle) ) )
+            continue;
+         entry.is_overdue = is_overdue_only;
+         struct epoll_event ev{};
+         ev.events = EPOLLIN;
+         ev.data.u64 = token;
+         epoll_ctl(epoll_fd, EPOLL_CTL_MOD, entry.fd, &ev);
+         entry.is_throttled = false;
+         CaptureBudget::instance().throttle_ended(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - entry.throttled_at).count());
+      }
+   }
+
+   // Milliseconds until the next throttled pipe is overdue, -1 if none can be
+   int OutputDrainer::next_overdue_ms()
+   //----------------------------------
+   {
+      auto max_throttle = std::chrono::milliseconds(CaptureBudget::instance().max_throttle_ms());
+      if (max_throttle.count() == 0)
+         return -1;
+      std::lock_guard<std::mutex> lock(mtx);
+      auto now = std::chrono::steady_clock::now();
+      long long next = -1;
+      for (const auto& [token, entry] : entries)
+      {
+         if (! entry.is_throttled) continue;
+         long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(entry.throttled_at + max_throttle - now).count();
+         ms = std::max(ms, 0LL);
+         if ( (next < 0) || (ms < next) ) next = ms;
+      }
+      return static_cast<int>(next);
+   }
+
+   void OutputDrainer::run()
+   //-----------------------
+   {
+      sigset_t mask;
+      sigemptyset(&mask);
+      sigaddset(&mask, SIGCHLD);
+      if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
+         perror("pthread_sigmask (OutputDrainer)");
+      struct epoll_event events[128];
+      while (true)
+      {
+         int n = epoll_wait(epoll_fd, events, 128, next_overdue_ms());
+         if (n < 0)
+         {
+            if (errno == EINTR) continue;
+            perror("epoll_wait (OutputDrainer)");
+            break;
+         }
+         resume(true);
+         for (int i=0; i<n; i++)
+         {
+            std::uint64_t token = events[i].data.u64;
+            if (token == 0)
+               return;
+            if (token == 1)
+            {
+               resume(false);
+               continue;
+            }
+            Entry entry;
+            {
+               std::lock_guard<std::mutex> lock(mtx);
+               auto it = entries.find(token);
+               if (it == entries.end()) continue;
+               entry = it->second;
+               it->second.is_overdue = false;
+            }
+            std::shared_ptr<Process> process = entry.process.lock();
+            if (! process) // Process gone, nobody else will close its pipe
+            {
+               std::lock_guard<std::mutex> lock(mtx);
+               unwatch(token, entry.fd);
+               close(entry.fd);
+               continue;
+            }
+            CaptureBudget& budget = CaptureBudget::instance();
+            if ( ((events[i].events & (EPOLLHUP | EPOLLERR)) == 0) && (! entry.is_overdue) && (budget.is_exceeded()) &&
+                 (budget.is_heavy(process->budget_charged)) )
+            {
+               throttle(token);
+               continue;
+            }
+            if (process->drain_output(entry.stream, entry.fd))
+            {
+               std::lock_guard<std::mutex> lock(mtx);
+               unwatch(token, entry.fd);
+               process->close_output(entry.stream, entry.fd);
+            }
+         }
+      }
+   }
+}
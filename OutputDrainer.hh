@@ -0,0 +1,54 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifndef _71d0f5b2a8c94e3f9e6a0c2b4d8f1e57
+#define _71d0f5b2a8c94e3f9e6a0c2b4d8f1e57
+namespace posix_util
+{
+   class Process;
+
+   // Background reader for the capture pipes of async children (see Process::set_background_drain). The pipes
+   // are made non-blocking and read until EAGAIN whenever epoll reports them readable, so children never block
+   // on a full pipe, unless CaptureBudget is exceeded when the pipes of the heaviest producers are not read
+   // until memory is released. The reading thread has SIGCHLD blocked.
+   class OutputDrainer
+   //=================
+   {
+   public:
+      static OutputDrainer& instance();
+      ~OutputDrainer();
+      OutputDrainer(const OutputDrainer& other) = delete;
+      OutputDrainer& operator=(const OutputDrainer& other) = delete;
+
+      bool watch(const std::shared_ptr<Process>& process);
+      std::size_t watched();
+
+   private:
+      OutputDrainer();
+      void run();
+      void unwatch(std::uint64_t token, int fd);
+      void throttle(std::uint64_t token);
+      void resume(bool is_overdue_only);
+      int next_overdue_ms();
+
+      struct Entry
+      {
+         std::weak_ptr<Process> process;
+         int stream;
+         int fd;
+         bool is_throttled = false;
+         bool is_overdue = false; // Resumed after CaptureBudget::max_throttle_ms, read once before throttling again
+         std::chrono::steady_clock::time_point throttled_at;
+      };
+      std::unordered_map<std::uint64_t, Entry> entries;
+      std::uint64_t next_token;
+      int epoll_fd, wake_fd;
+      std::mutex mtx;
+      std::thread worker;
+   };
+}
+#endif
@@ -3,19 +3,44 @@
 #include <cerrno>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <filesystem>
 #include <mutex>
 #include <thread>
+#include <algorithm>
 
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <cstring>
 
 #include "Process.hh"
+#include "MemFd.hh"
+#include "Timer.hh"
+#include "LineSplitter.hh"
+#include "RecordDecoder.hh"
+#include "OutputDrainer.hh"
+#include "CaptureCodec.hh"
+#include "LineFilter.hh"
+#include "ResultRegion.hh"
+#include "CaptureBudget.hh"
+#include "Builtins.hh"
+#include "NumaPlacement.hh"
+#include "ExecPrefetch.hh"
+
+extern char **environ;
 
 namespace posix_util
 {
@@ -23,14 +48,295 @@ namespace posix_util
    std::unordered_map<pid_t, std::shared_ptr<Process>> Process::outstanding_pids{};
    std::atomic_bool Process::has_child_handler{false};
    std::mutex Process::child_handler_mutex{}, Process::outstanding_mutex{};
+   TerminationLadder Process::default_termination_ladder{ {SIGTERM, 500}, {SIGINT, 500}, {SIGKILL, 0} };
 
-   Process::Process(const std::string& pth)
-   //--------------------------------------
+   static std::atomic<int> notify_epoll_fd{-1}, notify_event_fd{-1};
+   static std::vector<std::shared_ptr<Process>> completed_queue; // Protected by outstanding_mutex
+   // Children reaped by the death handler before async_execute registered them (only recorded while an
+   // async_execute is between fork and registration), pid to wait status. Protected by outstanding_mutex
+   static std::unordered_map<pid_t, int> unclaimed_exits;
+   static int registering = 0;
+
+   static std::mutex output_ready_mutex;
+   static std::vector<std::weak_ptr<Process>> output_ready_queue;
+
+   static std::mutex image_mutex;
+
+   namespace
+   {
+      // Locks a mutex also taken by the child death handler (a capture mutex or outstanding_mutex) with SIGCHLD
+      // blocked so the handler cannot interrupt the holder on this thread and deadlock.
+      class HandlerGuard
+      //================
+      {
+      public:
+         explicit HandlerGuard(std::mutex& m) : mtx(m)
+         {
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGCHLD);
+            pthread_sigmask(SIG_BLOCK, &mask, &previous);
+            mtx.lock();
+         }
+         ~HandlerGuard()
+         {
+            mtx.unlock();
+            pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+         }
+         HandlerGuard(const HandlerGuard&) = delete;
+         HandlerGuard& operator=(const HandlerGuard&) = delete;
+
+      private:
+         std::mutex& mtx;
+         sigset_t previous;
+      };
+
+      // Writes all of data to fd (waiting for fd to become writable if it is non-blocking)
+      bool write_all(int fd, const char* data, std::size_t len)
+      //--------------------------------------------------------
+      {
+         while (len > 0)
+         {
+            ssize_t count = write(fd, data, len);
+            if (count < 0)
+            {
+               if (errno == EINTR) continue;
+               if (errno == EAGAIN)
+               {
+                  struct pollfd pfd = { fd, POLLOUT, 0 };
+                  poll(&pfd, 1, -1);
+                  continue;
+               }
+               return false;
+            }
+            data += count;
+            len -= static_cast<std::size_t>(count);
+         }
+         return true;
+      }
+
+      // Applies attributes to the calling (forked child) process, reporting the first failure on stderr
+      bool apply_spawn_attributes(const SpawnAttributes& attributes)
+      //------------------------------------------------------------
+      {
+         if (! attributes.cpus.empty())
+         {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : attributes.cpus)
+               CPU_SET(cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            {
+               perror("sched_setaffinity");
+               return false;
+            }
+         }
+         if (attributes.policy != SpawnAttributes::unset)
+         {
+            struct sched_param param = {};
+            if (sched_setscheduler(0, attributes.policy, &param) != 0)
+            {
+               perror("sched_setscheduler");
+               return false;
+            }
+         }
+         if ( (attributes.nice != SpawnAttributes::unset) && (setpriority(PRIO_PROCESS, 0, attributes.nice) != 0) )
+         {
+            perror("setpriority");
+            return false;
+         }
+         if (attributes.io_class != SpawnAttributes::unset)
+         {
+            static constexpr int ioprio_who_process = 1, ioprio_class_shift = 13;
+            int level = (attributes.io_class == 3) ? 0 : attributes.io_level;
+            if (syscall(SYS_ioprio_set, ioprio_who_process, 0, (attributes.io_class << ioprio_class_shift) | level) != 0)
+            {
+               perror("ioprio_set");
+               return false;
+            }
+         }
+         return true;
+      }
+
+      // Prefers allocating the calling (forked child) process's memory on node. Failure (eg set_mempolicy denied
+      // in a container) leaves the default local allocation policy.
+      void prefer_memory_node(int node)
+      //-------------------------------
+      {
+         static constexpr int bits = 8 * sizeof(unsigned long);
+         unsigned long mask[1024 / bits] = {};
+         if (node >= 1024)
+            return;
+         mask[node / bits] |= 1UL << (node % bits);
+         syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, 1024UL);
+      }
+
+      // True if the file open on fd holds exactly len bytes equal to data (guards against hash collisions)
+      bool is_same_contents(int fd, const void* data, std::size_t len)
+      //--------------------------------------------------------------
+      {
+         struct stat st;
+         if ( (fstat(fd, &st) != 0) || (static_cast<std::size_t>(st.st_size) != len) )
+            return false;
+         const char* p = static_cast<const char*>(data);
+         char buffer[65536];
+         std::size_t offset = 0;
+         while (offset < len)
+         {
+            ssize_t count = pread(fd, buffer, std::min(sizeof(buffer), len - offset), static_cast<off_t>(offset));
+            if ( (count < 0) && (errno == EINTR) ) continue;
+            if ( (count <= 0) || (std::memcmp(buffer, p + offset, static_cast<std::size_t>(count)) != 0) )
+               return false;
+            offset += static_cast<std::size_t>(count);
+         }
+         return true;
+      }
+
+      // Duplicates each (parent fd, child fd) pair onto the child fd in a forked child, inherited across exec. The
+      // sources are first moved above all targets so no mapping can overwrite the source of another. moved is
+      // sized by the parent before fork (one slot per mapping) so the child does not allocate. Returns false if
+      // a mapping could not be made.
+      bool remap_fds(const std::vector<std::pair<int, int>>& fd_map, std::vector<int>& moved)
+      //-------------------------------------------------------------------------------------
+      {
+         if (moved.size() < fd_map.size())
+         {
+            errno = EINVAL;
+            return false;
+         }
+         int above = 0;
+         for (const std::pair<int, int>& mapping : fd_map)
+            above = std::max(above, std::max(mapping.first, mapping.second) + 1);
+         for (std::size_t i=0; i<fd_map.size(); i++)
+         {
+            moved[i] = fcntl(fd_map[i].first, F_DUPFD_CLOEXEC, above);
+            if (moved[i] < 0)
+               return false;
+         }
+         for (std::size_t i=0; i<fd_map.size(); i++)
+         {
+            int ret;
+            while (((ret = dup2(moved[i], fd_map[i].second)) == -1) && (errno == EINTR)) {}
+            if (ret == -1)
+               return false;
+            close(moved[i]);
+         }
+         return true;
+      }
+
+      // Duplicates the unread contents of pipe to the tee destination without consuming them, returning the
+      // number of bytes duplicated (which the caller must then read), 0 at EOF or if none are available
+      // without waiting (-1 with errno EAGAIN) or -1 if the destination does not support splice.
+      ssize_t tee_relay(int pipe, TeeTarget& target, bool is_wait)
+      //----------------------------------------------------------
+      {
+         ssize_t teed;
+         while (true)
+         {
+            teed = tee(pipe, target.relay[1], 65536, SPLICE_F_NONBLOCK);
+            if (teed >= 0) break;
+            if (errno == EINTR) continue;
+            if ( (errno == EAGAIN) && (is_wait) )
+            {
+               struct pollfd pfd = { pipe, POLLIN, 0 };
+               if ( (poll(&pfd, 1, -1) < 0) && (errno != EINTR) )
+                  return -1;
+               continue;
+            }
+            if (errno != EAGAIN)
+               target.is_copy = true;
+            return -1;
+         }
+         std::size_t remaining = static_cast<std::size_t>(teed);
+         while (remaining > 0)
+         {
+            ssize_t count = splice(target.relay[0], nullptr, target.fd, nullptr, remaining, SPLICE_F_MOVE);
+            if (count < 0)
+            {
+               if (errno == EINTR) continue;
+               if (errno == EAGAIN)
+               {
+                  struct pollfd pfd = { target.fd, POLLOUT, 0 };
+                  poll(&pfd, 1, -1);
+                  continue;
+               }
+               // Destination does not support splice, copy what is left in the relay and copy from now on
+               target.is_copy = true;
+               char buffer[65536];
+               while (remaining > 0)
+               {
+                  count = read(target.relay[0], buffer, std::min(remaining, sizeof(buffer)));
+                  if (count <= 0)
+                  {
+                     if ( (count < 0) && (errno == EINTR) ) continue;
+                     break;
+                  }
+                  write_all(target.fd, buffer, static_cast<std::size_t>(count));
+                  target.copied += static_cast<std::uint64_t>(count);
+                  remaining -= static_cast<std::size_t>(count);
+               }
+               return teed;
+            }
+            target.spliced += static_cast<std::uint64_t>(count);
+            remaining -= static_cast<std::size_t>(count);
+         }
+         return teed;
+      }
+   }
+
+   bool TeeTarget::open(int destination)
+   //-----------------------------------
+   {
+      close();
+      if (destination < 0)
+         return true;
+      if (pipe2(relay, O_CLOEXEC | O_NONBLOCK) != 0)
+      {
+         relay[0] = relay[1] = -1;
+         is_copy = true; // No relay, copy instead
+      }
+      fd = destination;
+      return true;
+   }
+
+   void TeeTarget::close()
+   //---------------------
+   {
+      for (int& end : relay)
+      {
+         if (end >= 0)
+            ::close(end);
+         end = -1;
+      }
+      fd = -1;
+      is_copy = false;
+      spliced = copied = 0;
+   }
+
+   // Images keyed by a hash of their contents (a caller's buffer may be reused or freed and its address reused)
+   static std::unordered_map<std::size_t, std::weak_ptr<MemFd>> loaded_images;
+
+   void Process::init()
+   //------------------
    {
-      char buf[8192];
       stdout_raw.clear(); stderr_raw.clear();
       stdout_lines.clear(); stderr_lines.clear();
       stdout_pipe = stderr_pipe = -1;
+      side_fd = side_child_fd = -1;
+      is_stdin_pipe = false;
+      stdin_pipe = -1;
+      result_memfd.reset();
+      result_child_fd = -1;
+      inputs.clear();
+      mapped_fds.clear();
+      for (Redirect& redirect : redirects)
+         redirect = Redirect();
+      spawn_attributes = SpawnAttributes();
+      is_numa_spread = false;
+      numa_placement = nullptr;
+      numa_index = -1;
+      numa_placed = nullptr;
+      budget_charged = 0;
       last_status = -1;
       last_err = 0;
       last_error_mess = "";
@@ -39,6 +345,41 @@ namespace posix_util
       filepath.clear();
       is_search_path = false;
       custom_async_child_death = nullptr;
+      image.reset();
+      child_function = nullptr;
+      run_memfd.reset();
+      builtin_name.clear();
+      process_group = ProcessGroup::inherit;
+      group_exit_signal = 0;
+      pgid = -1;
+      wall_timeout_ms = idle_timeout_ms = 0;
+      timeout_ladder = default_termination_ladder;
+      timeout_state = Timeout::none;
+      last_activity_ms = 0;
+      capture_mode = CaptureMode::separate;
+      is_background_drain = false;
+      is_compress_captures = false;
+      compress_min_size = 4096;
+   }
+
+   Process::~Process()
+   //-----------------
+   {
+      close_stdin();
+      release_numa_node();
+      if (! is_background_drain) // Otherwise the drainer closes them once it sees the process is gone
+      {
+         for (int pipe_fd : { stdout_pipe, stderr_pipe })
+            if (pipe_fd >= 0) close(pipe_fd);
+      }
+      CaptureBudget::instance().adjust(budget_charged.exchange(0), 0);
+   }
+
+   Process::Process(const std::string& pth)
+   //--------------------------------------
+   {
+      char buf[8192];
+      init();
       char* prealpath;
       if ( (pth.find_last_of('/') == std::string::npos) && (pth.find_last_of('\\') == std::string::npos) )
       {
@@ -73,32 +414,93 @@ namespace posix_util
       }
    }
 
+   Process::Process()
+   //----------------
+   {
+      init();
+   }
+
+   Process::Process(const std::string& name, const void* image_data, std::size_t image_len)
+   //--------------------------------------------------------------------------------------
+   {
+      init();
+      image = load_image(name, image_data, image_len);
+      if (! image)
+      {
+         last_err = errno;
+         last_error_mess = "Could not load executable image into memfd";
+         return;
+      }
+      filepath = name;
+   }
+
+   std::shared_ptr<MemFd> Process::load_image(const std::string& name, const void* image_data, std::size_t image_len)
+   //---------------------------------------------------------------------------------------------------------------
+   {
+      if ( (image_data == nullptr) || (image_len == 0) )
+      {
+         errno = EINVAL;
+         return nullptr;
+      }
+      std::size_t key = std::hash<std::string_view>()(std::string_view(static_cast<const char*>(image_data), image_len));
+      std::lock_guard<std::mutex> lock(image_mutex);
+      for (auto it = loaded_images.begin(); it != loaded_images.end(); )
+      {
+         if (it->second.expired())
+            it = loaded_images.erase(it);
+         else
+            ++it;
+      }
+      auto it = loaded_images.find(key);
+      if (it != loaded_images.end())
+      {
+         std::shared_ptr<MemFd> loaded = it->second.lock();
+         if ( (loaded) && (is_same_contents(loaded->fd(), image_data, image_len)) )
+            return loaded;
+      }
+      std::shared_ptr<MemFd> memfd = std::make_shared<MemFd>(name.c_str());
+      if ( (! memfd->create(true)) || (! memfd->write(image_data, image_len)) || (! memfd->seal()) )
+      {
+         errno = memfd->last_error();
+         return nullptr;
+      }
+      loaded_images[key] = memfd;
+      return memfd;
+   }
+
    bool Process::sync_execute(std::vector<std::string>& args, bool is_stdout, bool is_stderr, int timeout_ms)
    //-----------------------------------------------------------------------------------------------------
    {
       pid = -1;
       stdout_raw.clear(); stderr_raw.clear();
+      reset_captures();
       stdout_pipe = stderr_pipe = -1;
+      side_fd = -1;
+      side_messages.clear();
+      close_stdin();
       stdout_lines.clear(); stderr_lines.clear();
       last_status = -1;
-      if (filepath.empty())
+      if ( (filepath.empty()) && (! child_function) )
       {
          last_err = -99;
          last_error_mess = "Path to executable not specified or not found.";
          return false;
       }
+      if ( (! builtin_name.empty()) && (run_builtin(args, is_stdout, is_stderr)) )
+         return (last_status == 0);
       if (! fork_exec(args, is_stdout, is_stderr, stdout_pipe, stderr_pipe))
          return false;
-      if (is_stdout) 
+      if (process_group != ProcessGroup::inherit)
       {
-         read_stream(stdout_pipe, stdout_raw);
-         close(stdout_pipe);
-      }
-      if (is_stderr) 
-      {
-         read_stream(stderr_pipe, stderr_raw);
-         close(stderr_pipe);
+         int wstatus = wait_leader(is_stdout, is_stderr, timeout_ms);
+         if (wstatus == std::numeric_limits<int>::min())
+            last_status = wstatus;
+         else if (WIFEXITED(wstatus))
+            last_status = WEXITSTATUS(wstatus);
+         return (last_status == 0);
       }
+      capture_streams();
+      finish_output();
       int wstatus;
       if (timeout_ms <= 0)
          waitpid(pid, &wstatus, 0);
@@ -106,8 +508,12 @@ namespace posix_util
          wstatus = timed_waitpid(pid, timeout_ms);
       if (wstatus == std::numeric_limits<int>::min())
          last_status = wstatus;
-      else if (WIFEXITED(wstatus))
-         last_status = WEXITSTATUS(wstatus);
+      else
+      {
+         release_numa_node();
+         if (WIFEXITED(wstatus))
+            last_status = WEXITSTATUS(wstatus);
+      }
       return (last_status == 0);
    }
 
@@ -117,7 +523,11 @@ namespace posix_util
    {
       pid = -1;
       stdout_raw.clear(); stderr_raw.clear();
+      reset_captures();
       stdout_pipe = stderr_pipe = -1;
+      side_fd = -1;
+      side_messages.clear();
+      close_stdin();
       stdout_lines.clear(); stderr_lines.clear();
       last_status = -1;
       if (! me)
@@ -126,17 +536,49 @@ namespace posix_util
          last_error_mess = "Null shared_ptr for me parameter";
          return false;
       }
-      if (filepath.empty())
+      if ( (filepath.empty()) && (! child_function) )
       {
          last_err = -99;
          last_error_mess = "Path to executable not specified or not found.";
          return false;
       }
       set_child_death_handler(&default_child_death_handler);
-      if (! fork_exec(args, is_stdout, is_stderr, stdout_pipe, stderr_pipe))
+      {
+         HandlerGuard lock(Process::outstanding_mutex);
+         registering++;
+      }
+      bool is_forked = fork_exec(args, is_stdout, is_stderr, stdout_pipe, stderr_pipe);
+      bool is_reaped = false;
+      int reaped_status = 0;
+      {
+         // A child which exits immediately may already have been reaped by the death handler (on any thread)
+         HandlerGuard lock(Process::outstanding_mutex);
+         auto it = (is_forked) ? unclaimed_exits.find(pid) : unclaimed_exits.end();
+         if (it != unclaimed_exits.end())
+         {
+            is_reaped = true;
+            reaped_status = it->second;
+            unclaimed_exits.erase(it);
+         }
+         if (--registering == 0)
+            unclaimed_exits.clear(); // Anything left was not started by async_execute
+         if ( (is_forked) && (! is_reaped) )
+         {
+            Process::outstanding_pids[pid] = me;
+            // Room for every outstanding child to be queued, so notify_completion never grows the queue
+            std::size_t needed = completed_queue.size() + Process::outstanding_pids.size();
+            if (completed_queue.capacity() < needed)
+               completed_queue.reserve(2 * needed);
+         }
+      }
+      if (! is_forked)
          return false;
-      std::lock_guard<std::mutex> lock(Process::outstanding_mutex);
-      Process::outstanding_pids[pid] = me;
+      start_timeouts(me);
+      if (is_background_drain)
+         OutputDrainer::instance().watch(me);
+      watch_output();
+      if (is_reaped)
+         complete_unregistered(me, reaped_status);
 #ifdef __DEBUG__
       std::cout << "async_execute: " << pid << " " << this->extra_name << " started" << std::endl;
 #endif
@@ -147,258 +589,1696 @@ namespace posix_util
          last_error_mess = "Could not set stdout pipe to non-blocking.";
          return false;
       }
-      if ( (is_stderr) && (! nonblocking(stderr_pipe)) )
+      if ( (is_stderr) && (! nonblocking(stderr_pipe)) )
+      {
+         last_err = -99;
+         last_error_mess = "Could not set stderr pipe to non-blocking.";
+         return false;
+      }
+*/
+      return true;
+   }
+
+   int Process::async_read_stdout()
+   //------------------------------
+   {
+      int n = capture_stream(STDOUT_FILENO, ReadMode::poll);
+      if (n > 0) output_activity();
+      return n;
+   }
+
+   int Process::async_read_stderr()
+   //------------------------------
+   {
+      int n = capture_stream(STDERR_FILENO, ReadMode::poll);
+      if (n > 0) output_activity();
+      return n;
+   }
+
+   static std::int64_t monotonic_ms()
+   //--------------------------------
+   {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+   }
+
+   void Process::output_activity() { last_activity_ms = monotonic_ms(); }
+
+   void Process::set_timeouts(int wall_ms, int idle_ms, const TerminationLadder& ladder)
+   //-----------------------------------------------------------------------------------
+   {
+      wall_timeout_ms = wall_ms;
+      idle_timeout_ms = idle_ms;
+      timeout_ladder = ladder;
+   }
+
+   // Timers are not cancelled when the child completes, an expired timer for a completed child is a no-op. The
+   // idle timer is not reset by output either, instead on expiry it is rearmed for the remainder of the interval
+   // measured from the last output.
+   void Process::start_timeouts(const std::shared_ptr<Process>& me)
+   //--------------------------------------------------------------
+   {
+      timeout_state = Timeout::none;
+      output_activity();
+      std::weak_ptr<Process> wp = me;
+      if (wall_timeout_ms > 0)
+         Timer::instance().schedule(wall_timeout_ms, [wp]()
+         {
+            std::shared_ptr<Process> p = wp.lock();
+            if ( (p) && (p->is_running) && (p->timeout_state == Timeout::none) )
+            {
+               p->timeout_state = Timeout::wall;
+               p->kill_async(p, p->timeout_ladder);
+            }
+         });
+      if (idle_timeout_ms > 0)
+         Timer::instance().schedule(idle_timeout_ms, [wp]() { idle_check(wp); });
+   }
+
+   void Process::idle_check(std::weak_ptr<Process> wp)
+   //-------------------------------------------------
+   {
+      std::shared_ptr<Process> p = wp.lock();
+      if ( (! p) || (! p->is_running) || (p->timeout_state != Timeout::none) )
+         return;
+      std::int64_t idle = monotonic_ms() - p->last_activity_ms;
+      if (idle < p->idle_timeout_ms)
+      {
+         Timer::instance().schedule(static_cast<int>(p->idle_timeout_ms - idle), [wp]() { idle_check(wp); });
+         return;
+      }
+      p->timeout_state = Timeout::idle;
+      p->kill_async(p, p->timeout_ladder);
+   }
+
+   bool Process::is_alive()
+   //----------------------
+   {
+      if ( (! is_running) || (pid < 0) ) return false;
+      int wstatus;
+      if (waitpid(pid, &wstatus, WNOHANG) == pid)
+      {
+         if (WIFEXITED(wstatus))
+            last_status = WEXITSTATUS(wstatus);
+         is_running = false;
+         release_numa_node();
+         read_all_after_death();
+         on_child_death();
+         HandlerGuard lock(Process::outstanding_mutex);
+         auto it = Process::outstanding_pids.find(pid);
+         if (it != Process::outstanding_pids.end())
+         {
+            notify_completion(it->second);
+            Process::outstanding_pids.erase(it);
+         }
+         return false;
+      }
+      int status = ::kill(pid, 0);
+      if (status == 0) return true;
+      return false;
+   }
+
+   // Liveness check for timer callbacks, which must not block: unlike is_alive the child is not reaped (so its
+   // output, which descendants may hold open, is not read) and is left for its owner to wait for
+   bool Process::is_unreaped_alive() const
+   //-------------------------------------
+   {
+      if ( (! is_running) || (pid <= 0) ) return false;
+      siginfo_t info{};
+      if (waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOHANG | WNOWAIT) != 0)
+         return false; // Already reaped
+      return (info.si_pid == 0);
+   }
+
+   int Process::kill(const TerminationLadder& ladder)
+   //------------------------------------------------
+   {
+      int wstatus = std::numeric_limits<int>::min();
+      for (const TerminationStage& stage : ladder)
+      {
+         signal_group(stage.signal);
+         if (stage.grace_ms <= 0)
+            continue;
+         wstatus = timed_waitpid(pid, stage.grace_ms);
+         if (wstatus != std::numeric_limits<int>::min())
+         {
+            release_numa_node();
+            break;
+         }
+      }
+      return wstatus;
+   }
+
+   bool Process::kill_async(const std::shared_ptr<Process>& me, const TerminationLadder& ladder)
+   //--------------------------------------------------------------------------------------------
+   {
+      if ( (! me) || (me.get() != this) )
+      {
+         last_err = -98;
+         last_error_mess = "Null or mismatched shared_ptr for me parameter";
+         return false;
+      }
+      if ( (! is_running) || (pid <= 0) || (ladder.empty()) )
+         return false;
+      terminate_stage(me, ladder, 0);
+      return true;
+   }
+
+   int Process::kill_all(const std::vector<std::shared_ptr<Process>>& processes, const TerminationLadder& ladder)
+   //------------------------------------------------------------------------------------------------------------
+   {
+      int n = 0;
+      for (const std::shared_ptr<Process>& p : processes)
+         if ( (p) && (p->kill_async(p, ladder)) )
+            n++;
+      return n;
+   }
+
+   // Sends the signal for stage and schedules the check for the next one. Children started by async_execute
+   // complete through the SIGCHLD handler as usual, other children are left to be reaped by their owner.
+   void Process::terminate_stage(std::weak_ptr<Process> wp, TerminationLadder ladder, std::size_t stage)
+   //-----------------------------------------------------------------------------------------------------
+   {
+      std::shared_ptr<Process> p = wp.lock();
+      if (! p) return;
+      bool is_async;
+      {
+         HandlerGuard lock(Process::outstanding_mutex);
+         is_async = (Process::outstanding_pids.find(p->pid) != Process::outstanding_pids.end());
+      }
+      bool alive = (is_async) ? p->running() : p->is_unreaped_alive();
+      if ( (! alive) || (stage >= ladder.size()) )
+         return;
+      p->signal_group(ladder[stage].signal);
+      int grace_ms = ladder[stage].grace_ms;
+      if (stage + 1 >= ladder.size())
+      {
+         if (is_async) return;
+         if (grace_ms <= 0) grace_ms = 100;
+      }
+      Timer::instance().schedule(grace_ms, [wp, ladder, stage]() { terminate_stage(wp, ladder, stage + 1); });
+   }
+
+   int Process::signal_group(int signal)
+   //-----------------------------------
+   {
+      if (pgid > 0)
+         return ::kill(-pgid, signal);
+      if (pid > 0)
+         return ::kill(pid, signal);
+      errno = ESRCH;
+      return -1;
+   }
+
+   // Reaps group members (including descendants reparented to this process when it is a child subreaper) until
+   // none are left. Returns the number reaped or -1 if members remain after timeout_ms (0 waits indefinitely).
+   int Process::wait_group(int timeout_ms)
+   //-------------------------------------
+   {
+      if (pgid <= 0) return 0;
+      int n = 0;
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+      while (true)
+      {
+         int wstatus;
+         pid_t wpid = waitpid(-pgid, &wstatus, WNOHANG);
+         if (wpid > 0)
+         {
+            if (wpid == pid)
+            {
+               if (WIFEXITED(wstatus))
+                  last_status = WEXITSTATUS(wstatus);
+               is_running = false;
+            }
+            n++;
+            continue;
+         }
+         if ( (wpid < 0) && (errno == EINTR) ) continue;
+         if (wpid < 0) // ECHILD: no children left in the group (or they are not ours to reap)
+            break;
+         if ( (timeout_ms > 0) && (std::chrono::steady_clock::now() >= deadline) )
+            return -1;
+         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return n;
+   }
+
+   bool Process::set_child_subreaper(bool is_subreaper)
+   //---------------------------------------------------
+   {
+      if (prctl(PR_SET_CHILD_SUBREAPER, (is_subreaper) ? 1 : 0, 0, 0, 0) != 0)
+      {
+         perror("prctl PR_SET_CHILD_SUBREAPER");
+         return false;
+      }
+      return true;
+   }
+
+   // Used by sync_execute for children in their own group/session: reads output until the child itself exits
+   // (instead of until EOF which descendants may delay indefinitely) then drains whatever is left in the pipes.
+   int Process::wait_leader(bool is_stdout, bool is_stderr, int timeout_ms)
+   //----------------------------------------------------------------------
+   {
+      int wstatus = std::numeric_limits<int>::min();
+      int pidfd = -1;
+#ifdef SYS_pidfd_open
+      pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#endif
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+      bool is_exited = false;
+      while (! is_exited)
+      {
+         struct pollfd fds[4];
+         nfds_t nfds = 0;
+         int out_index = -1, err_index = -1, side_index = -1;
+         if ( (is_stdout) && (stdout_pipe >= 0) ) { out_index = nfds; fds[nfds++] = {stdout_pipe, POLLIN, 0}; }
+         if ( (is_stderr) && (stderr_pipe >= 0) ) { err_index = nfds; fds[nfds++] = {stderr_pipe, POLLIN, 0}; }
+         if (side_fd >= 0) { side_index = nfds; fds[nfds++] = {side_fd, POLLIN, 0}; }
+         if (pidfd >= 0) fds[nfds++] = {pidfd, POLLIN, 0};
+         int poll_ms = (pidfd >= 0) ? 1000 : 50;
+         if (timeout_ms > 0)
+         {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+               break;
+            if (remaining.count() < poll_ms) poll_ms = static_cast<int>(remaining.count());
+         }
+         int ret = poll(fds, nfds, poll_ms);
+         if ( (ret < 0) && (errno != EINTR) )
+         {
+            perror("poll");
+            break;
+         }
+         if ( (out_index >= 0) && (fds[out_index].revents & (POLLIN | POLLHUP)) )
+         {
+            if (capture_stream(STDOUT_FILENO, ReadMode::poll) <= 0)
+            {
+               close(stdout_pipe);
+               stdout_pipe = -1;
+            }
+         }
+         if ( (err_index >= 0) && (fds[err_index].revents & (POLLIN | POLLHUP)) )
+         {
+            if (capture_stream(STDERR_FILENO, ReadMode::poll) <= 0)
+            {
+               close(stderr_pipe);
+               stderr_pipe = -1;
+            }
+         }
+         if ( (side_index >= 0) && (fds[side_index].revents & (POLLIN | POLLHUP)) )
+            receive_messages();
+         int status;
+         pid_t wpid = waitpid(pid, &status, WNOHANG);
+         if (wpid == pid)
+         {
+            wstatus = status;
+            is_exited = true;
+            is_running = false;
+         }
+         else if (wpid < 0) // Reaped elsewhere (eg by a SIGCHLD handler)
+         {
+            is_exited = true;
+            is_running = false;
+         }
+      }
+      if (pidfd >= 0)
+         close(pidfd);
+      if (! is_exited) // Timed out, the child keeps running but its output is no longer read
+      {
+         for (int* fd : { &stdout_pipe, &stderr_pipe, &side_fd })
+         {
+            if (*fd >= 0)
+               close(*fd);
+            *fd = -1;
+         }
+         return wstatus;
+      }
+      release_numa_node();
+      if (group_exit_signal != 0)
+         signal_group(group_exit_signal);
+      if (stdout_pipe >= 0)
+      {
+         capture_stream(STDOUT_FILENO, ReadMode::drain);
+         close(stdout_pipe);
+      }
+      if (stderr_pipe >= 0)
+      {
+         capture_stream(STDERR_FILENO, ReadMode::drain);
+         close(stderr_pipe);
+      }
+      stdout_pipe = stderr_pipe = -1;
+      receive_messages();
+      if (side_fd >= 0)
+      {
+         close(side_fd);
+         side_fd = -1;
+      }
+      finish_output();
+      return wstatus;
+   }
+
+   bool Process::fork_exec(std::vector<std::string>& args, bool is_stdout, bool is_stderr,
+                           int& stdoutt, int& stderrr)
+   //---------------------------------------------------------------------------------------
+   {
+      stdoutt = stderrr = -1;
+      // Redirected streams bypass the parent entirely
+      bool is_redirected_out = (redirects[STDOUT_FILENO].kind != Redirect::Kind::inherit);
+      bool is_redirected_err = (redirects[STDERR_FILENO].kind != Redirect::Kind::inherit);
+      if (is_redirected_out) is_stdout = false;
+      if (is_redirected_err) is_stderr = false;
+      bool is_pipe = ( (is_stdout) || (is_stderr) );
+      bool is_merged = ( (is_pipe) && (capture_mode == CaptureMode::merged) && (! is_redirected_out) &&
+                         (! is_redirected_err) );
+      if (is_merged)
+      {
+         is_stdout = true;
+         is_stderr = false;
+      }
+      last_error_mess = ""; last_err = 0;
+      int stdout_pipes[2] = { -1, -1 }, stderr_pipes[2] = { -1, -1 }, stdin_pipes[2] = { -1, -1 };
+      int side_sockets[2] = { -1, -1 };
+      auto close_created = [&]() // Every fd created so far, when failing before the child is started
+      {
+         for (int* fds : { stdout_pipes, stderr_pipes, stdin_pipes, side_sockets })
+         {
+            for (int i = 0; i < 2; i++)
+               if (fds[i] >= 0) close(fds[i]);
+         }
+      };
+      if (is_pipe)
+      {
+         if (is_stdout)
+         {
+            if ((last_err = pipe2(stdout_pipes, O_CLOEXEC)) == -1)
+            {
+               perror("pipe");
+               last_error_mess = "Creating pipe for stdout";
+               return false;
+            }
+         }
+         if (is_stderr)
+         {
+            if ((last_err = pipe2(stderr_pipes, O_CLOEXEC)) == -1)
+            {
+               perror("pipe");
+               last_error_mess = "Creating pipe for stderr";
+               close_created();
+               return false;
+            }
+         }
+      }
+      if ( (is_stdin_pipe) && (redirects[STDIN_FILENO].kind == Redirect::Kind::inherit) && ((last_err = pipe2(stdin_pipes, O_CLOEXEC)) == -1) )
+      {
+         perror("pipe");
+         last_error_mess = "Creating pipe for stdin";
+         close_created();
+         return false;
+      }
+      if ( (side_child_fd >= 0) && (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, side_sockets) != 0) )
+      {
+         last_err = errno;
+         perror("socketpair");
+         last_error_mess = "Creating side channel";
+         close_created();
+         return false;
+      }
+      ResultRegionHeader* region = result_header();
+      if (region != nullptr)
+         region->reset(result_memfd->size() - ResultRegionHeader::SIZE);
+      for (const std::pair<int, std::shared_ptr<MemFd>>& input : inputs)
+      {
+         MemFd& memfd = *input.second;
+         if (! memfd.is_sealed())
+         {
+            memfd.unmap(); // Writable mappings prevent sealing
+            if (! memfd.seal())
+            {
+               last_err = memfd.last_error();
+               last_error_mess = "Sealing input";
+               close_created();
+               return false;
+            }
+         }
+         lseek(memfd.fd(), 0, SEEK_SET); // The offset is shared with the child (and any previous ones)
+      }
+      std::vector<std::pair<int, int>> fd_map; // Parent fd, child fd
+      if (side_sockets[1] >= 0)
+         fd_map.emplace_back(side_sockets[1], side_child_fd);
+      if (region != nullptr)
+         fd_map.emplace_back(result_memfd->fd(), result_child_fd);
+      for (const std::pair<int, std::shared_ptr<MemFd>>& input : inputs)
+         fd_map.emplace_back(input.second->fd(), input.first);
+      fd_map.insert(fd_map.end(), mapped_fds.begin(), mapped_fds.end());
+      for (int stream : { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO })
+         if (redirects[stream].kind == Redirect::Kind::fd) fd_map.emplace_back(redirects[stream].fd, stream);
+      std::vector<int> moved_fds(fd_map.size());
+      SpawnAttributes attributes = spawn_attributes;
+      int memory_node = -1;
+      release_numa_node(); // Placement of a previous child
+      if (is_numa_spread)
+      {
+         NumaPlacement& placement = (numa_placement != nullptr) ? *numa_placement : NumaPlacement::instance();
+         int index = placement.acquire();
+         if (index >= 0)
+         {
+            numa_placed = &placement;
+            numa_index = index;
+            memory_node = placement.node(static_cast<std::size_t>(index)).id;
+            if (attributes.cpus.empty()) // An explicit affinity takes precedence
+               attributes.cpus = placement.node(static_cast<std::size_t>(index)).cpus;
+         }
+      }
+      if (child_function)
+         fflush(nullptr); // Otherwise the child inherits and flushes pending stdio output again
+      else
+         run_memfd.reset();
+      pid = fork();
+      if (pid == -1)
+      {
+         perror("fork");
+         last_err = errno;
+         last_error_mess = "Fork failed";
+         release_numa_node();
+         close_created();
+         return false;
+      }
+      else if (pid == 0)  // Child
+      {
+         sigset_t child_mask; // The caller may have SIGCHLD blocked (eg HandlerGuard) and exec keeps the mask
+         sigemptyset(&child_mask);
+         sigaddset(&child_mask, SIGCHLD);
+         sigprocmask(SIG_UNBLOCK, &child_mask, nullptr);
+         if (process_group == ProcessGroup::new_session)
+            setsid();
+         else if (process_group == ProcessGroup::new_group)
+            setpgid(0, 0);
+         if (is_stdout)
+         {
+            while ((dup2(stdout_pipes[1], STDOUT_FILENO) == -1) && (errno == EINTR)) {}
+            if (is_merged)
+               while ((dup2(stdout_pipes[1], STDERR_FILENO) == -1) && (errno == EINTR)) {}
+            close(stdout_pipes[1]);
+            close(stdout_pipes[0]);
+         }
+         if (is_stderr)
+         {
+            while ((dup2(stderr_pipes[1], STDERR_FILENO) == -1) && (errno == EINTR)) {}
+            close(stderr_pipes[1]);
+            close(stderr_pipes[0]);
+         }
+         if (stdin_pipes[0] >= 0)
+         {
+            while ((dup2(stdin_pipes[0], STDIN_FILENO) == -1) && (errno == EINTR)) {}
+            close(stdin_pipes[0]);
+            close(stdin_pipes[1]);
+         }
+         if (! remap_fds(fd_map, moved_fds))
+         {
+            perror("Passing fds to child");
+            _exit(1);
+         }
+         for (int stream : { STDERR_FILENO, STDOUT_FILENO, STDIN_FILENO }) // stderr first to report failures there
+         {
+            const Redirect& redirect = redirects[stream];
+            if (redirect.kind != Redirect::Kind::path) continue;
+            int fd = open(redirect.path.c_str(), redirect.flags, redirect.mode);
+            if (fd < 0)
+            {
+               perror(redirect.path.c_str());
+               _exit(1);
+            }
+            if (fd != stream)
+            {
+               while ((dup2(fd, stream) == -1) && (errno == EINTR)) {}
+               close(fd);
+            }
+         }
+         if (! apply_spawn_attributes(attributes))
+            _exit(1);
+         if (memory_node >= 0)
+            prefer_memory_node(memory_node);
+         if (child_function)
+            _exit(run_child());
+         std::vector<char*> commandVector;
+         commandVector.push_back(const_cast<char*>(filepath.filename().c_str()));
+         for (auto it = args.begin(); it != args.end(); ++it)
+            commandVector.push_back(const_cast<char*>((*it).c_str()));
+         commandVector.push_back(NULL);
+         char **command = commandVector.data();
+         if (image)
+            fexecve(image->fd(), &command[0], environ);
+         else if (is_search_path)
+            execvp(filepath.c_str(), &command[0]);
+         else
+            execv(filepath.c_str(), &command[0]);
+         perror("sync_execute");
+         _exit(1);
+      }
+      //parent
+      is_running = true;
+      if (process_group != ProcessGroup::inherit)
+      {
+         if (process_group == ProcessGroup::new_group) // Also set in the parent to avoid racing the child
+            setpgid(pid, pid);
+         pgid = pid;
+      }
+      else
+         pgid = -1;
+      if (is_stdout)
+      {
+         close(stdout_pipes[1]);
+         stdoutt = stdout_pipes[0];
+      }
+      if (is_stderr)
+      {
+         close(stderr_pipes[1]);
+         stderrr = stderr_pipes[0];
+      }
+      if (side_sockets[1] >= 0)
+      {
+         close(side_sockets[1]);
+         side_fd = side_sockets[0];
+      }
+      if (stdin_pipes[0] >= 0)
+      {
+         close(stdin_pipes[0]);
+         stdin_pipe = stdin_pipes[1];
+      }
+      return true;
+   }
+
+   bool Process::prepare_run(const ChildFunction& fn)
+   //------------------------------------------------
+   {
+      if (! fn)
+      {
+         last_err = -97;
+         last_error_mess = "No function to run";
+         return false;
+      }
+      run_memfd = std::make_shared<MemFd>("run");
+      if (! run_memfd->create())
+      {
+         last_err = run_memfd->last_error();
+         last_error_mess = "Creating run result memfd";
+         run_memfd.reset();
+         return false;
+      }
+      child_function = fn;
+      return true;
+   }
+
+   bool Process::sync_run(const ChildFunction& fn, bool is_stdout, bool is_stderr, int timeout_ms)
+   //--------------------------------------------------------------------------------------------
+   {
+      if (! prepare_run(fn))
+         return false;
+      std::vector<std::string> args;
+      bool is_ok = sync_execute(args, is_stdout, is_stderr, timeout_ms);
+      child_function = nullptr;
+      return is_ok;
+   }
+
+   bool Process::async_run(const ChildFunction& fn, const std::shared_ptr<Process>& me, bool is_stdout, bool is_stderr)
+   //----------------------------------------------------------------------------------------------------------------
+   {
+      if (! prepare_run(fn))
+         return false;
+      std::vector<std::string> args;
+      bool is_ok = async_execute(args, me, is_stdout, is_stderr);
+      child_function = nullptr;
+      return is_ok;
+   }
+
+   // Returns false (having done nothing) if the command needs to be spawned
+   void Process::set_builtin(bool is_enabled)
+   //----------------------------------------
+   {
+      builtin_name.clear();
+      if ( (! is_enabled) || (! is_search_path) || (filepath.empty()) )
+         return;
+      std::string resolved = ExecPrefetch::resolve(filepath.string());
+      if (! resolved.empty()) // Not symlinks resolved, so eg /bin/echo -> busybox still qualifies
+      {
+         std::filesystem::path dir = std::filesystem::path(resolved).lexically_normal().parent_path();
+         if ( (dir != "/bin") && (dir != "/usr/bin") && (dir != "/sbin") && (dir != "/usr/sbin") )
+            return;
+      }
+      builtin_name = filepath.string();
+   }
+
+   bool Process::run_builtin(const std::vector<std::string>& args, bool is_stdout, bool is_stderr)
+   //---------------------------------------------------------------------------------------------
+   {
+      if ( (child_function) || (image) || (process_group != ProcessGroup::inherit) ||
+           (capture_mode == CaptureMode::timestamped) || (side_child_fd >= 0) || (result_memfd) ||
+           (! inputs.empty()) || (is_stdin_pipe) || (captures[0].tee.active()) || (captures[1].tee.active()) ||
+           (redirects[STDOUT_FILENO].kind != Redirect::Kind::inherit) ||
+           (redirects[STDERR_FILENO].kind != Redirect::Kind::inherit) || (! mapped_fds.empty()) ||
+           (spawn_attributes.is_set()) || (is_numa_spread) )
+         return false;
+      bool is_merged = ( ( (is_stdout) || (is_stderr) ) && (capture_mode == CaptureMode::merged) );
+      std::string out, err;
+      int status = Builtins::instance().run(builtin_name, args, out, (is_merged) ? out : err);
+      if (status == Builtins::not_handled)
+         return false;
+      if (is_merged)
+      {
+         is_stdout = true;
+         is_stderr = false;
+      }
+      if (! is_stdout)
+         write_all(STDOUT_FILENO, out.data(), out.size());
+      if ( (! is_stderr) && (! is_merged) )
+         write_all(STDERR_FILENO, err.data(), err.size());
+      HandlerGuard guard(capture_mutex);
+      if ( (is_stdout) && (! out.empty()) )
+         append_output(STDOUT_FILENO, out.data(), out.size());
+      if ( (is_stderr) && (! err.empty()) )
+         append_output(STDERR_FILENO, err.data(), err.size());
+      finish_output();
+      last_status = status;
+      return true;
+   }
+
+   // Runs in the child, an exception escaping fn must not unwind into the parent's code
+   int Process::run_child()
+   //----------------------
+   {
+      std::string result;
+      int status;
+      try
+      {
+         status = child_function(result);
+      }
+      catch (const std::exception& e)
+      {
+         std::cerr << "Exception in child function: " << e.what() << std::endl;
+         status = EXIT_FAILURE;
+      }
+      catch (...)
+      {
+         std::cerr << "Exception in child function" << std::endl;
+         status = EXIT_FAILURE;
+      }
+      if ( (! result.empty()) && (! run_memfd->write(result.data(), result.size())) )
+         status = EXIT_FAILURE;
+      std::cout.flush();
+      fflush(nullptr);
+      return status;
+   }
+
+   std::string Process::run_result() const
+   //-------------------------------------
+   {
+      std::string result;
+      if (! run_memfd)
+         return result;
+      result.resize(run_memfd->size());
+      std::size_t len = 0;
+      while (len < result.size())
+      {
+         ssize_t count = pread(run_memfd->fd(), result.data() + len, result.size() - len, static_cast<off_t>(len));
+         if ( (count < 0) && (errno == EINTR) ) continue;
+         if (count <= 0) break;
+         len += static_cast<std::size_t>(count);
+      }
+      result.resize(len);
+      return result;
+   }
+
+   int Process::timed_waitpid(pid_t pid, int timeout_ms)
+   //----------------------------------------
+   {
+      int wstatus = std::numeric_limits<int>::min();
+      while (waitpid(pid, &wstatus, WNOHANG) == 0)
+      {
+         if (timeout_ms < 0)
+            break;
+         std::this_thread::sleep_for(std::chrono::milliseconds(100)); //usleep(100000);
+         timeout_ms -= 100;
+      }
+      return wstatus;
+   }
+
+   int Process::async_read_stream(int pipe, std::string& raw, int timeout_ms)
+   //-----------------------------------------------------------------
+   {
+      return read_pipe(pipe, ReadMode::poll, [&raw](const char* data, std::size_t len) { raw.append(data, len); },
+                       timeout_ms);
+   }
+
+   // Reads from pipe according to mode passing each chunk read to sink. Returns the number of bytes read or -1
+   // on a read error.
+   int Process::read_pipe(int pipe, ReadMode mode, const std::function<void(const char*, std::size_t)>& sink,
+                          int timeout_ms, bool* is_eof, TeeTarget* tee)
+   //--------------------------------------------------------------------------------------------------------
+   {
+      if (is_eof != nullptr) *is_eof = false;
+      if (pipe < 0) return 0;
+      if (mode == ReadMode::poll)
+      {
+         struct pollfd fds[1];
+         fds[0].fd = pipe;
+         fds[0].events = POLLIN;
+         fds[0].revents = 0;
+         int ret = poll(fds, 1, timeout_ms);
+         if ( (ret <= 0) || ( ((fds[0].revents & POLLIN) == 0) && ((fds[0].revents & POLLHUP) == 0) ) )
+            return 0;
+      }
+      else if (mode == ReadMode::drain)
+      {
+         int flags = fcntl(pipe, F_GETFL);
+         if ( (flags >= 0) && ((flags & O_NONBLOCK) == 0) )
+            fcntl(pipe, F_SETFL, flags | O_NONBLOCK);
+      }
+      char buffer[65536];
+      int no = 0;
+      if ( (tee != nullptr) && (! tee->active()) )
+         tee = nullptr;
+      while (true)
+      {
+         std::size_t limit = sizeof(buffer);
+         bool is_teed = false;
+         if ( (tee != nullptr) && (! tee->is_copy) )
+         {
+            // Only read what was duplicated so output arriving in between is not missed by the tee
+            ssize_t teed = tee_relay(pipe, *tee, (mode == ReadMode::eof));
+            is_teed = (teed > 0);
+            if (is_teed)
+               limit = static_cast<std::size_t>(teed);
+            else if ( (teed < 0) && (! tee->is_copy) && (mode != ReadMode::eof) ) // Nothing available
+               break;
+         }
+         ssize_t count = read(pipe, buffer, limit);
+         if (count < 0)
+         {
+            int err = errno;
+            if (err == EINTR) continue;
+            if (err == EAGAIN) break;
+            perror("read");
+            return (no > 0) ? no : -1;
+         }
+         if (count == 0)
+         {
+            if (is_eof != nullptr) *is_eof = true;
+            break;
+         }
+         no += count;
+         if ( (tee != nullptr) && (tee->is_copy) && (! is_teed) )
+         {
+            // Fallback, a single write per (up to 64K) read
+            write_all(tee->fd, buffer, static_cast<std::size_t>(count));
+            tee->copied += static_cast<std::uint64_t>(count);
+         }
+         sink(buffer, static_cast<std::size_t>(count));
+         if (mode == ReadMode::poll) break;
+      }
+      return no;
+   }
+
+   int Process::capture_stream(int stream, ReadMode mode, int timeout_ms)
+   //--------------------------------------------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      return read_pipe(stream_pipe(stream), mode,
+                       [this, stream](const char* data, std::size_t len) { append_output(stream, data, len); },
+                       timeout_ms, nullptr, &stream_capture(stream).tee);
+   }
+
+   // Called on the background drainer thread when fd is readable, returns true at EOF. Background drained
+   // pipes are only closed by the drainer (through close_output), so a pipe which is no longer the current one
+   // was left open by a later execution and is finished with.
+   bool Process::drain_output(int stream, int fd)
+   //--------------------------------------------
+   {
+      bool is_eof = false;
+      int n;
+      {
+         HandlerGuard guard(capture_mutex);
+         if (stream_pipe(stream) != fd) // A previous execution's
+            return true;
+         if (stream == side_channel_stream)
+            return (receive_side(false) < 0);
+         // With a capture budget read once per readiness event so the budget is checked between reads
+         ReadMode mode = (CaptureBudget::instance().limit() > 0) ? ReadMode::poll : ReadMode::drain;
+         n = read_pipe(fd, mode,
+                       [this, stream](const char* data, std::size_t len) { append_output(stream, data, len); },
+                       0, &is_eof, &stream_capture(stream).tee);
+      }
+      if (n > 0)
+      {
+         output_activity();
+         std::shared_ptr<Process> me;
+         {
+            HandlerGuard lock(Process::outstanding_mutex);
+            auto it = Process::outstanding_pids.find(pid);
+            if (it != Process::outstanding_pids.end())
+               me = it->second;
+         }
+         if (me)
+            notify_output(me);
+      }
+      return ( (is_eof) || (n < 0) );
+   }
+
+   void Process::close_output(int stream, int fd)
+   //--------------------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      close(fd);
+      if (stream_pipe(stream) == fd)
+         stream_pipe(stream) = -1;
+   }
+
+   // Reads stdout, stderr and the side channel until EOF on all. They are polled (rather than read one after
+   // the other) so the child cannot block writing to one while another is being read and so chunks are
+   // timestamped in order.
+   int Process::capture_streams()
+   //----------------------------
+   {
+      int n = 0;
+      while ( (stdout_pipe >= 0) || (stderr_pipe >= 0) || (side_fd >= 0) )
+      {
+         if ( (side_fd < 0) && ( (stdout_pipe < 0) || (stderr_pipe < 0) ) )
+         {
+            int stream = (stdout_pipe >= 0) ? STDOUT_FILENO : STDERR_FILENO;
+            n += capture_stream(stream, ReadMode::eof);
+            close(stream_pipe(stream));
+            stream_pipe(stream) = -1;
+            break;
+         }
+         struct pollfd fds[3];
+         int streams[3];
+         nfds_t nfds = 0;
+         for (int stream : { STDOUT_FILENO, STDERR_FILENO, side_channel_stream })
+         {
+            if (stream_pipe(stream) < 0) continue;
+            streams[nfds] = stream;
+            fds[nfds++] = { stream_pipe(stream), POLLIN, 0 };
+         }
+         if (poll(fds, nfds, -1) < 0)
+         {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+         }
+         for (nfds_t i=0; i<nfds; i++)
+         {
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue;
+            int stream = streams[i];
+            if (stream == side_channel_stream)
+            {
+               receive_messages();
+               continue;
+            }
+            int count = capture_stream(stream, ReadMode::poll);
+            if (count <= 0)
+            {
+               close(stream_pipe(stream));
+               stream_pipe(stream) = -1;
+            }
+            else
+               n += count;
+         }
+      }
+      return n;
+   }
+
+   // Receives the queued side channel messages (waiting for one if is_wait), closing the channel at EOF (when
+   // -1 is returned) unless the drainer owns it. Called with capture_mutex held.
+   int Process::receive_side(bool is_wait)
+   //-------------------------------------
+   {
+      int n = 0;
+      while (side_fd >= 0)
+      {
+         // MSG_TRUNC returns the full length of the next message so it is never truncated
+         ssize_t len = recv(side_fd, nullptr, 0, MSG_PEEK | MSG_TRUNC | ((is_wait) ? 0 : MSG_DONTWAIT));
+         std::string message;
+         if (len > 0)
+         {
+            message.resize(static_cast<std::size_t>(len));
+            len = recv(side_fd, message.data(), message.size(), MSG_DONTWAIT);
+         }
+         if (len < 0)
+         {
+            if (errno == EINTR) continue;
+            if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+               return n;
+            perror("recv (side channel)");
+         }
+         if (len <= 0) // EOF (zero length messages are not sent by SideChannel)
+         {
+            if (! is_background_drain) // Otherwise closed by the drainer
+            {
+               close(side_fd);
+               side_fd = -1;
+            }
+            return -1;
+         }
+         if (on_side_message)
+            on_side_message(message);
+         side_messages.push_back(std::move(message));
+         n++;
+         is_wait = false;
+      }
+      return n;
+   }
+
+   bool Process::set_side_channel(int child_fd, std::function<void(std::string_view)> on_message)
+   //--------------------------------------------------------------------------------------------
+   {
+      if ( (child_fd != -1) && (child_fd <= STDERR_FILENO) )
+      {
+         last_err = EINVAL;
+         last_error_mess = "Invalid side channel fd";
+         return false;
+      }
+      side_child_fd = child_fd;
+      on_side_message = std::move(on_message);
+      return true;
+   }
+
+   int Process::receive_messages()
+   //-----------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      return receive_side(false);
+   }
+
+   void Process::close_stdin()
+   //-------------------------
+   {
+      if (stdin_pipe >= 0)
+         close(stdin_pipe);
+      stdin_pipe = -1;
+   }
+
+   Redirect Redirect::to_fd(int fd)
+   //------------------------------
+   {
+      Redirect redirect;
+      redirect.kind = Kind::fd;
+      redirect.fd = fd;
+      return redirect;
+   }
+
+   Redirect Redirect::to_path(const std::string& path, int flags, mode_t mode)
+   //-------------------------------------------------------------------------
+   {
+      Redirect redirect;
+      redirect.kind = Kind::path;
+      redirect.path = path;
+      redirect.flags = flags;
+      redirect.mode = mode;
+      return redirect;
+   }
+
+   Redirect Redirect::to_file(const std::string& path, bool is_append)
+   //-----------------------------------------------------------------
+   {
+      return to_path(path, O_WRONLY | O_CREAT | ((is_append) ? O_APPEND : O_TRUNC));
+   }
+
+   Redirect Redirect::from_file(const std::string& path) { return to_path(path, O_RDONLY); }
+
+   Redirect Redirect::null() { return to_path("/dev/null", O_RDWR); }
+
+   bool Process::set_redirect(int stream, const Redirect& target)
+   //------------------------------------------------------------
+   {
+      if ( (stream < STDIN_FILENO) || (stream > STDERR_FILENO) ||
+           ( (target.kind == Redirect::Kind::fd) && (target.fd < 0) ) ||
+           ( (target.kind == Redirect::Kind::path) && (target.path.empty()) ) )
+      {
+         last_err = EINVAL;
+         last_error_mess = "Invalid redirection";
+         return false;
+      }
+      redirects[stream] = target;
+      return true;
+   }
+
+   int Process::numa_node() const
+   //----------------------------
+   {
+      int index = numa_index;
+      return (index < 0) ? -1 : numa_placed->node(static_cast<std::size_t>(index)).id;
+   }
+
+   bool Process::prefetch() const
+   //----------------------------
+   {
+      if (image)
+         return true;
+      if (filepath.empty())
+         return false;
+      return ExecPrefetch::prefetch(filepath.string());
+   }
+
+   // Called when the child is reaped (possibly in the SIGCHLD handler, the release is an atomic decrement)
+   void Process::release_numa_node()
+   //-------------------------------
+   {
+      int index = numa_index.exchange(-1);
+      if (index >= 0)
+         numa_placed->release(index);
+   }
+
+   bool Process::set_spawn_attributes(const SpawnAttributes& attributes)
+   //-------------------------------------------------------------------
+   {
+      bool is_valid = true;
+      for (int cpu : attributes.cpus)
+         if ( (cpu < 0) || (cpu >= CPU_SETSIZE) ) is_valid = false;
+      if ( (attributes.nice != SpawnAttributes::unset) && ( (attributes.nice < -20) || (attributes.nice > 19) ) )
+         is_valid = false;
+      if ( (attributes.policy != SpawnAttributes::unset) && (attributes.policy != SCHED_OTHER) &&
+           (attributes.policy != SCHED_BATCH) && (attributes.policy != SCHED_IDLE) )
+         is_valid = false;
+      if ( (attributes.io_class != SpawnAttributes::unset) &&
+           ( (attributes.io_class < 1) || (attributes.io_class > 3) || (attributes.io_level < 0) ||
+             (attributes.io_level > 7) ) )
+         is_valid = false;
+      if (! is_valid)
+      {
+         last_err = EINVAL;
+         last_error_mess = "Invalid spawn attributes";
+         return false;
+      }
+      spawn_attributes = attributes;
+      return true;
+   }
+
+   bool Process::set_result_region(std::size_t capacity, int child_fd)
+   //-----------------------------------------------------------------
+   {
+      if ( (capacity > 0) && (child_fd <= STDERR_FILENO) )
+      {
+         last_err = EINVAL;
+         last_error_mess = "Invalid result region fd";
+         return false;
+      }
+      result_memfd.reset();
+      result_child_fd = -1;
+      if (capacity == 0)
+         return true;
+      std::shared_ptr<MemFd> region = std::make_shared<MemFd>("result");
+      // Pages are only allocated as the child writes them
+      if ( (! region->create()) || (! region->resize(ResultRegionHeader::SIZE + capacity)) ||
+           (region->map(0, true) == nullptr) )
+      {
+         last_err = region->last_error();
+         last_error_mess = "Creating result region";
+         return false;
+      }
+      static_cast<ResultRegionHeader*>(region->address())->reset(capacity);
+      result_memfd = region;
+      result_child_fd = child_fd;
+      return true;
+   }
+
+   std::shared_ptr<MemFd> Process::new_input(int child_fd, std::size_t len)
+   //----------------------------------------------------------------------
+   {
+      inputs.erase(std::remove_if(inputs.begin(), inputs.end(),
+                                  [child_fd](const std::pair<int, std::shared_ptr<MemFd>>& input)
+                                  { return (input.first == child_fd); }), inputs.end());
+      std::shared_ptr<MemFd> input = std::make_shared<MemFd>("input");
+      if ( (! input->create()) || (! input->resize(len)) )
+      {
+         last_err = input->last_error();
+         last_error_mess = "Creating input memfd";
+         return nullptr;
+      }
+      inputs.emplace_back(child_fd, input);
+      return input;
+   }
+
+   std::string Process::set_input(std::string_view data, int child_fd)
+   //-----------------------------------------------------------------
+   {
+      std::shared_ptr<MemFd> input = new_input(child_fd, 0);
+      if ( (! input) || (! input->write(data.data(), data.size())) || (! input->seal()) )
+      {
+         if (input)
+         {
+            last_err = input->last_error();
+            last_error_mess = "Writing input memfd";
+            inputs.pop_back();
+         }
+         return "";
+      }
+      return "/proc/self/fd/" + std::to_string(child_fd);
+   }
+
+   void* Process::map_input(std::size_t len, int child_fd)
+   //-----------------------------------------------------
+   {
+      std::shared_ptr<MemFd> input = new_input(child_fd, len);
+      if (! input)
+         return nullptr;
+      void* p = (len > 0) ? input->map(len, true) : nullptr;
+      if ( (p == nullptr) && (len > 0) )
+      {
+         last_err = input->last_error();
+         last_error_mess = "Mapping input memfd";
+         inputs.pop_back();
+      }
+      return p;
+   }
+
+   ResultRegionHeader* Process::result_header() const
+   //------------------------------------------------
+   {
+      return (result_memfd) ? static_cast<ResultRegionHeader*>(result_memfd->address()) : nullptr;
+   }
+
+   std::string_view Process::result() const
+   //--------------------------------------
+   {
+      const ResultRegionHeader* region = result_header();
+      if (region == nullptr)
+         return std::string_view();
+      return std::string_view(reinterpret_cast<const char*>(region) + ResultRegionHeader::SIZE, result_committed(region));
+   }
+
+   // The header is writable by the child so committed is bounded by the parent's own mapping of the region
+   std::size_t Process::result_committed(const ResultRegionHeader* region) const
+   //--------------------------------------------------------------------------
+   {
+      std::size_t committed = region->committed.load(std::memory_order_acquire);
+      std::size_t mapped = result_memfd->mapped_size();
+      std::size_t available = (mapped > ResultRegionHeader::SIZE) ? mapped - ResultRegionHeader::SIZE : 0;
+      return std::min(committed, available);
+   }
+
+   bool Process::result_complete() const
+   //-----------------------------------
+   {
+      const ResultRegionHeader* region = result_header();
+      return ( (region != nullptr) && (region->is_complete.load(std::memory_order_acquire) != 0) );
+   }
+
+   std::size_t Process::wait_result(std::size_t min_bytes, int timeout_ms) const
+   //---------------------------------------------------------------------------
+   {
+      const ResultRegionHeader* region = result_header();
+      if (region == nullptr)
+         return 0;
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+      while (true)
+      {
+         // A child which dies without completing the region does not wake the futex, so waits are sliced and
+         // end once it is no longer running (read before the region so its last publication is seen)
+         bool is_finished = (! is_running);
+         std::uint32_t seen = region->sequence.load(std::memory_order_acquire);
+         std::size_t committed = result_committed(region);
+         if ( (committed >= min_bytes) || (region->is_complete.load(std::memory_order_acquire) != 0) ||
+              (is_finished) )
+            return committed;
+         int wait_ms = 50;
+         if (timeout_ms > 0)
+         {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+               return committed;
+            wait_ms = std::min(wait_ms, static_cast<int>(remaining.count()));
+         }
+         region->wait(seen, wait_ms);
+      }
+   }
+
+   std::vector<std::string> Process::messages() const
+   //------------------------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      return side_messages;
+   }
+
+   void Process::append_output(int stream, const char* data, std::size_t len)
+   //------------------------------------------------------------------------
+   {
+      StreamCapture& capture = stream_capture(stream);
+      if (! capture.filter)
+      {
+         store_output(stream, data, len);
+         return;
+      }
+      std::size_t max_line = max_filtered_line;
+      if (capture.is_bounded)
+         max_line = std::min(max_line, std::max<std::size_t>(capture.head_limit + capture.tail.size(), 1));
+      std::string kept;
+      std::size_t start = 0;
+      while (start < len)
+      {
+         const void* p = std::memchr(data + start, '\n', len - start);
+         std::size_t end = (p == nullptr) ? len : static_cast<std::size_t>(static_cast<const char*>(p) - data);
+         std::string_view line(data + start, std::min(end - start, max_line));
+         if ( (p == nullptr) || (! capture.partial_line.empty()) )
+         {
+            std::size_t room = max_line - std::min(capture.partial_line.size(), max_line);
+            capture.partial_line.append(line.substr(0, room));
+            line = capture.partial_line;
+         }
+         if (p == nullptr)
+            break;
+         if ((*capture.filter)(line))
+         {
+            kept.append(line);
+            kept += '\n';
+         }
+         else
+            capture.filtered_lines++;
+         capture.partial_line.clear();
+         start = end + 1;
+      }
+      if (! kept.empty())
+         store_output(stream, kept.data(), kept.size());
+   }
+
+   void Process::store_output(int stream, const char* data, std::size_t len)
+   //-----------------------------------------------------------------------
+   {
+      std::string& raw = raw_buffer(stream);
+      StreamCapture& capture = stream_capture(stream);
+      inflate(stream); // Output after completion (eg from descendants)
+      if (capture.is_bounded)
+      {
+         std::size_t head = (raw.size() < capture.head_limit) ? std::min(capture.head_limit - raw.size(), len) : 0;
+         if (raw.capacity() < capture.head_limit)
+            raw.reserve(capture.head_limit);
+         push_tail(capture, data + head, len - head);
+         len = head;
+         if (len == 0) return;
+      }
+      raw.append(data, len);
+      if (capture_mode == CaptureMode::timestamped)
+      {
+         struct timespec ts;
+         clock_gettime(CLOCK_MONOTONIC, &ts);
+         chunks.push_back(OutputChunk{ static_cast<std::int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec,
+                                       static_cast<std::uint32_t>(len), static_cast<std::uint8_t>(stream) });
+      }
+      if (capture.decoder)
       {
-         last_err = -99;
-         last_error_mess = "Could not set stderr pipe to non-blocking.";
-         return false;
+         std::string_view pending(raw.data() + capture.decoded, raw.size() - capture.decoded);
+         capture.decoded += capture.decoder->decode(pending, false, capture.on_record);
+         if ( (capture.is_discard) && (capture.decoded > raw.size() / 2) )
+         {
+            raw.erase(0, capture.decoded);
+            capture.decoded = 0;
+         }
       }
-*/
-      return true;
+      account();
    }
 
-   int Process::async_read_stdout()  { return async_read_stream(stdout_pipe, stdout_raw); }
-
-   int Process::async_read_stderr()  { return async_read_stream(stderr_pipe, stderr_raw); }
+   // Updates the capture memory charged to the CaptureBudget, called with capture_mutex held
+   void Process::account()
+   //---------------------
+   {
+      std::size_t charge = stdout_raw.capacity() + stderr_raw.capacity();
+      for (const StreamCapture& capture : captures)
+         charge += capture.compressed.capacity() + capture.tail.capacity() + capture.partial_line.capacity();
+      std::size_t previous = budget_charged.exchange(charge);
+      if (charge != previous)
+         CaptureBudget::instance().adjust(previous, charge);
+   }
 
-   bool Process::is_alive()
-   //----------------------
+   void Process::clear_captures()
+   //----------------------------
    {
-      if ( (! is_running) || (pid < 0) ) return false;
-      int wstatus;
-      if (waitpid(pid, &wstatus, WNOHANG) == pid)
+      HandlerGuard guard(capture_mutex);
+      for (std::string* raw : { &stdout_raw, &stderr_raw })
       {
-         if (WIFEXITED(wstatus))
-            last_status = WEXITSTATUS(wstatus);
-         is_running = false;
-         read_all_after_death();
-         on_child_death();
-         std::lock_guard<std::mutex> lock(Process::outstanding_mutex);
-         auto it = Process::outstanding_pids.find(pid);
-         if (it != Process::outstanding_pids.end())
-            Process::outstanding_pids.erase(it);
-         return false;
+         raw->clear();
+         raw->shrink_to_fit();
       }
-      int status = ::kill(pid, 0);
-      if (status == 0) return true;
-      return false;
+      for (std::vector<std::string>* lines : { &stdout_lines, &stderr_lines })
+      {
+         lines->clear();
+         lines->shrink_to_fit();
+      }
+      reset_captures();
    }
 
-   int Process::kill()
-   //-------------------
+   void Process::reset_captures()
+   //----------------------------
    {
-      ::kill(pid, SIGTERM);
-      int wstatus = timed_waitpid(pid, 500);
-      if (wstatus == std::numeric_limits<int>::min())
+      for (StreamCapture& capture : captures)
       {
-         ::kill(pid, SIGINT);
-         wstatus = timed_waitpid(pid, 500);
-         if (wstatus == std::numeric_limits<int>::min())
-         {
-            ::kill(pid, SIGKILL);
-            return wstatus;
-         }
+         capture.decoded = 0;
+         capture.compressed.clear();
+         capture.compressed.shrink_to_fit();
+         capture.original_size = 0;
+         capture.composed.clear();
+         capture.composed.shrink_to_fit();
+         capture.tail_fill = capture.tail_pos = 0;
+         capture.elided_bytes = capture.elided_lines = 0;
+         capture.partial_line.clear();
+         capture.filtered_lines = 0;
       }
-      return wstatus;
+      chunks.clear();
+      account();
    }
 
-   bool Process::fork_exec(std::vector<std::string>& args, bool is_stdout, bool is_stderr,
-                           int& stdoutt, int& stderrr)
-   //---------------------------------------------------------------------------------------
+   void Process::set_capture_limit(int stream, std::size_t head_bytes, std::size_t tail_bytes)
+   //----------------------------------------------------------------------------------------
    {
-      stdoutt = stderrr = -1;
-      bool is_pipe = ( (is_stdout) || (is_stderr) );
-      last_error_mess = ""; last_err = 0;
-      int stdout_pipes[2], stderr_pipes[2];
-      if (is_pipe)
+      StreamCapture& capture = stream_capture(stream);
+      capture.is_bounded = ( (head_bytes > 0) || (tail_bytes > 0) );
+      capture.head_limit = head_bytes;
+      capture.tail.assign(tail_bytes, '\0');
+      capture.tail.shrink_to_fit();
+      capture.tail_fill = capture.tail_pos = 0;
+   }
+
+   void Process::set_line_filter(int stream, std::shared_ptr<LineFilter> filter)
+   //--------------------------------------------------------------------------
+   {
+      StreamCapture& capture = stream_capture(stream);
+      capture.filter = std::move(filter);
+      capture.partial_line.clear();
+      capture.filtered_lines = 0;
+   }
+
+   bool Process::set_tee(int stream, int fd)
+   //---------------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      return stream_capture(stream).tee.open(fd);
+   }
+
+   std::size_t Process::filtered_lines(int stream) const { return captures[(stream == STDERR_FILENO) ? 1 : 0].filtered_lines; }
+
+   std::size_t Process::elided_bytes(int stream) const { return captures[(stream == STDERR_FILENO) ? 1 : 0].elided_bytes; }
+
+   std::size_t Process::elided_lines(int stream) const { return captures[(stream == STDERR_FILENO) ? 1 : 0].elided_lines; }
+
+   // Writes data into the tail ring, counting the bytes (and lines) of the oldest output it displaces
+   void Process::push_tail(StreamCapture& capture, const char* data, std::size_t len)
+   //-------------------------------------------------------------------------------
+   {
+      const std::size_t size = capture.tail.size();
+      auto elide = [&capture](const char* p, std::size_t n)
       {
-         if (is_stdout)
-         {
-            if ((last_err = pipe(stdout_pipes)) == -1)
-            {
-               perror("pipe");
-               last_error_mess = "Creating pipe for stdout";
-               return false;
-            }
-         }
-         if (is_stderr)
-         {
-            if ((last_err = pipe(stderr_pipes)) == -1)
-            {
-               perror("pipe");
-               last_error_mess = "Creating pipe for stderr";
-               return false;
-            }
-         }
+         capture.elided_bytes += n;
+         capture.elided_lines += static_cast<std::size_t>(std::count(p, p + n, '\n'));
+      };
+      if (len >= size)
+      {
+         std::size_t oldest = (capture.tail_pos + size - capture.tail_fill) % std::max<std::size_t>(size, 1);
+         std::size_t first = std::min(capture.tail_fill, size - oldest);
+         elide(capture.tail.data() + oldest, first);
+         elide(capture.tail.data(), capture.tail_fill - first);
+         elide(data, len - size);
+         if (size > 0)
+            capture.tail.replace(0, size, data + len - size, size);
+         capture.tail_fill = size;
+         capture.tail_pos = 0;
+         return;
       }
-      pid = fork();
-      if (pid == -1)
+      std::size_t overflow = (capture.tail_fill + len > size) ? capture.tail_fill + len - size : 0;
+      if (overflow > 0)
       {
-         perror("fork");
-         last_err = errno;
-         last_error_mess = "Fork failed";
+         std::size_t oldest = (capture.tail_pos + size - capture.tail_fill) % size;
+         std::size_t first = std::min(overflow, size - oldest);
+         elide(capture.tail.data() + oldest, first);
+         elide(capture.tail.data(), overflow - first);
+      }
+      std::size_t first = std::min(len, size - capture.tail_pos);
+      capture.tail.replace(capture.tail_pos, first, data, first);
+      capture.tail.replace(0, len - first, data + first, len - first);
+      capture.tail_pos = (capture.tail_pos + len) % size;
+      capture.tail_fill = std::min(size, capture.tail_fill + len);
+   }
+
+   bool Process::deflate(int stream)
+   //-------------------------------
+   {
+      StreamCapture& capture = stream_capture(stream);
+      std::string& raw = raw_buffer(stream);
+      if ( (! capture.compressed.empty()) || (raw.size() < compress_min_size) || (raw.empty()) )
+         return false;
+      std::string compressed;
+      if ( (! CaptureCodec::compress(raw, compressed)) || (compressed.size() >= raw.size()) )
          return false;
+      capture.compressed.swap(compressed);
+      capture.original_size = raw.size();
+      raw.clear();
+      raw.shrink_to_fit();
+      std::vector<std::string>& lines = line_buffer(stream);
+      lines.clear();
+      lines.shrink_to_fit();
+      account();
+      return true;
+   }
+
+   void Process::inflate(int stream)
+   //-------------------------------
+   {
+      StreamCapture& capture = stream_capture(stream);
+      if (capture.compressed.empty())
+         return;
+      std::string& raw = raw_buffer(stream);
+      if (! CaptureCodec::decompress(capture.compressed, capture.original_size, raw))
+      {
+         perror("CaptureCodec::decompress");
+         raw.clear();
       }
-      else if (pid == 0)  // Child
+      capture.compressed.clear();
+      capture.compressed.shrink_to_fit();
+      capture.original_size = 0;
+      account();
+   }
+
+   // The output of stream, decompressed into scratch (rather than in place) if necessary
+   std::string_view Process::sealed_text(int stream, std::string& scratch) const
+   //---------------------------------------------------------------------------
+   {
+      const StreamCapture& capture = captures[(stream == STDERR_FILENO) ? 1 : 0];
+      std::string_view text = raw_buffer(stream);
+      if (! capture.compressed.empty())
       {
-         if (is_stdout)
-         {
-            while ((dup2(stdout_pipes[1], STDOUT_FILENO) == -1) && (errno == EINTR)) {}
-            close(stdout_pipes[1]);
-            close(stdout_pipes[0]);
-         }
-         if (is_stderr)
-         {
-            while ((dup2(stderr_pipes[1], STDERR_FILENO) == -1) && (errno == EINTR)) {}
-            close(stderr_pipes[1]);
-            close(stderr_pipes[0]);
-         }
-         std::vector<char*> commandVector;
-         commandVector.push_back(const_cast<char*>(filepath.filename().c_str()));
-         for (auto it = args.begin(); it != args.end(); ++it)
-            commandVector.push_back(const_cast<char*>((*it).c_str()));
-         commandVector.push_back(NULL);
-         char **command = commandVector.data();
-         if (is_search_path)
-            execvp(filepath.c_str(), &command[0]);
-         else
-            execv(filepath.c_str(), &command[0]);
-         perror("sync_execute");
-         _exit(1);
+         if (! CaptureCodec::decompress(capture.compressed, capture.original_size, scratch))
+            scratch.clear();
+         text = scratch;
       }
-      //parent
-      is_running = true;
-      if (is_stdout)
+      if ( (capture.tail_fill == 0) && (capture.elided_bytes == 0) )
+         return text;
+      // Bounded capture, present as head, elision marker and tail
+      std::string composed;
+      composed.reserve(text.size() + capture.tail_fill + 64);
+      composed.append(text);
+      if (capture.elided_bytes > 0)
       {
-         close(stdout_pipes[1]);
-         stdoutt = stdout_pipes[0];
+         if ( (! composed.empty()) && (composed.back() != '\n') )
+            composed += '\n';
+         composed += "[... " + std::to_string(capture.elided_bytes) + " bytes (" +
+                     std::to_string(capture.elided_lines) + " lines) elided ...]\n";
       }
-      if (is_stderr)
+      if (capture.tail_fill > 0)
       {
-         close(stderr_pipes[1]);
-         stderrr = stderr_pipes[0];
+         std::size_t oldest = (capture.tail_pos + capture.tail.size() - capture.tail_fill) % capture.tail.size();
+         std::size_t first = std::min(capture.tail_fill, capture.tail.size() - oldest);
+         composed.append(capture.tail, oldest, first);
+         composed.append(capture.tail, 0, capture.tail_fill - first);
       }
-      return true;
+      scratch.swap(composed);
+      return scratch;
    }
 
-   int Process::timed_waitpid(pid_t pid, int timeout_ms)
-   //----------------------------------------
+   // Splits the (decompressed or composed) output of stream into its line buffer
+   void Process::split_lines(int stream)
+   //-----------------------------------
    {
-      int wstatus = std::numeric_limits<int>::min();
-      while (waitpid(pid, &wstatus, WNOHANG) == 0)
+      std::string scratch;
+      std::vector<std::string_view> views;
+      LineSplitter::split(sealed_text(stream, scratch), views);
+      std::vector<std::string>& lines = line_buffer(stream);
+      lines.assign(views.begin(), views.end());
+   }
+
+   bool Process::compact()
+   //---------------------
+   {
+      HandlerGuard guard(capture_mutex); // Appends after compaction inflate first so running children are safe
+      bool is_out = deflate(STDOUT_FILENO);
+      bool is_err = deflate(STDERR_FILENO);
+      return ( (is_out) || (is_err) );
+   }
+
+   std::size_t Process::capture_memory() const
+   //-----------------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      std::size_t total = stdout_raw.capacity() + stderr_raw.capacity() + chunks.capacity() * sizeof(OutputChunk);
+      for (const StreamCapture& capture : captures)
+         total += capture.compressed.capacity() + capture.tail.capacity() + capture.composed.capacity() +
+                  capture.partial_line.capacity();
+      for (const std::vector<std::string>* lines : { &stdout_lines, &stderr_lines })
       {
-         if (timeout_ms < 0)
+         total += lines->capacity() * sizeof(std::string);
+         for (const std::string& line : *lines)
+            if (line.capacity() > 15) total += line.capacity();
+      }
+      return total;
+   }
+
+   void Process::for_each_chunk(const std::function<void(const OutputChunk&, std::string_view)>& visitor) const
+   //----------------------------------------------------------------------------------------------------------
+   {
+      std::size_t offsets[2] = { 0, 0 };
+      std::string scratch[2];
+      std::string_view text[2] = { sealed_text(STDOUT_FILENO, scratch[0]), sealed_text(STDERR_FILENO, scratch[1]) };
+      for (const OutputChunk& chunk : chunks)
+      {
+         std::string_view raw = text[(chunk.stream == STDERR_FILENO) ? 1 : 0];
+         std::size_t& offset = offsets[(chunk.stream == STDERR_FILENO) ? 1 : 0];
+         if (offset + chunk.length > raw.size()) // Buffer modified since (eg by a discarding decoder)
             break;
-         std::this_thread::sleep_for(std::chrono::milliseconds(100)); //usleep(100000);
-         timeout_ms -= 100;
+         visitor(chunk, std::string_view(raw.data() + offset, chunk.length));
+         offset += chunk.length;
       }
-      return wstatus;
    }
 
-   int Process::async_read_stream(int pipe, std::string& raw, int timeout_ms)
-   //-----------------------------------------------------------------
+   std::string Process::interleaved_output() const
+   //---------------------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      std::string interleaved;
+      interleaved.reserve(stdout_raw.size() + stderr_raw.size());
+      for_each_chunk([&interleaved](const OutputChunk&, std::string_view data) { interleaved.append(data); });
+      return interleaved;
+   }
+
+   // Called once all output has been read
+   void Process::finish_output()
+   //---------------------------
    {
-//#ifdef __LINUX__
-//      int n;
-//      if (ioctl(pipe, FIONREAD, &n) != -1)
-//         if (n <= 0) return 0;
-//      else
-//         perror("ioctl");
-//#endif
-      struct pollfd fds[1];
-      fds[0].fd = pipe;
-      fds[0].events = POLLIN;
-      fds[0].revents = 0;
-      ssize_t count = 0;
-      int ret = poll(fds, 1, timeout_ms);
-      if ( (ret > 0) && ( (fds[0].revents & POLLIN) || (fds[0].revents & POLLHUP) ) )
-      {
-         char buffer[4096];
-         count = read(pipe, buffer, sizeof(buffer));
-         if (count == -1)
+      for (int stream : { STDOUT_FILENO, STDERR_FILENO })
+      {
+         StreamCapture& capture = stream_capture(stream);
+         if (! capture.partial_line.empty()) // Unterminated last line
          {
-            int err = errno;
-            if ((err == EINTR) || (err == EAGAIN)) return 0;
-//            std::cerr << strerror(err) << std::endl;
-            perror("read");
-            return -1;
+            std::string line;
+            line.swap(capture.partial_line);
+            if ((*capture.filter)(line))
+               store_output(stream, line.data(), line.size());
+            else
+               capture.filtered_lines++;
+         }
+         if (! capture.decoder) continue;
+         std::string& raw = raw_buffer(stream);
+         std::string_view pending(raw.data() + capture.decoded, raw.size() - capture.decoded);
+         capture.decoded += capture.decoder->decode(pending, true, capture.on_record);
+         if (capture.is_discard)
+         {
+            raw.erase(0, capture.decoded);
+            capture.decoded = 0;
          }
-         else if (count == 0) return 0;
-         buffer[count] = 0;
-         raw.append(buffer);
       }
-      else
-         count = 0;
-
-      return count;
+      if (is_compress_captures)
+      {
+         deflate(STDOUT_FILENO);
+         deflate(STDERR_FILENO);
+      }
    }
 
+   void Process::set_decoder(int stream, std::shared_ptr<RecordDecoder> decoder,
+                             std::function<void(std::string_view)> on_record, bool is_discard)
+   //------------------------------------------------------------------------------------------
+   {
+      StreamCapture& capture = stream_capture(stream);
+      capture.decoder = std::move(decoder);
+      capture.on_record = std::move(on_record);
+      capture.is_discard = is_discard;
+      capture.decoded = 0;
+   }
 
    int Process::read_all_after_death()
    //-----------------------------
    {
       int n = 0;
-      if (stdout_pipe >= 0)
-      {
-         n = read_stream(stdout_pipe, stdout_raw);
-         stdout_lines.clear();
-         split(stdout_raw, stdout_lines, "\n");
-      }
-      if (stderr_pipe >= 0)
+      // Descendants in the child's group may hold the pipes open after it exits so only take what is there
+      bool is_tree = (process_group != ProcessGroup::inherit);
+      if ( (is_tree) && (group_exit_signal != 0) )
+         signal_group(group_exit_signal);
+      ReadMode mode = (is_tree) ? ReadMode::drain : ReadMode::eof;
+      n = capture_stream(STDOUT_FILENO, mode);
+      n += capture_stream(STDERR_FILENO, mode);
+      HandlerGuard guard(capture_mutex);
+      receive_side(false);
+      if ( (side_fd >= 0) && (! is_background_drain) ) // Otherwise closed by the drainer at EOF
       {
-         n += read_stream(stderr_pipe, stderr_raw);
-         stderr_lines.clear();
-         split(stderr_raw, stderr_lines, "\n");
+         close(side_fd);
+         side_fd = -1;
       }
+      split_lines(STDOUT_FILENO);
+      split_lines(STDERR_FILENO);
+      finish_output();
       return n;
    }
 
+   std::string Process::raw_output()
+   //-------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      std::string scratch;
+      return std::string(sealed_text(STDOUT_FILENO, scratch));
+   }
+
+   std::string Process::raw_error()
+   //------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      std::string scratch;
+      return std::string(sealed_text(STDERR_FILENO, scratch));
+   }
+
    std::vector<std::string>::iterator Process::output_begin()
    //--------------------------------------------------------
    {
-      stdout_lines.clear();
-      split(stdout_raw, stdout_lines, "\n");
+      HandlerGuard guard(capture_mutex);
+      split_lines(STDOUT_FILENO);
       return stdout_lines.begin();
    }
 
    std::size_t Process::output_lc()
    //------------------------------
    {
-      stdout_lines.clear();
-      split(stdout_raw, stdout_lines, "\n");
+      HandlerGuard guard(capture_mutex);
+      split_lines(STDOUT_FILENO);
       return stdout_lines.size();
    }
 
    std::vector<std::string>::iterator Process::error_begin()
    //------------------------------------------------------
    {
-      stderr_lines.clear();
-      split(stderr_raw, stderr_lines, "\n");
+      HandlerGuard guard(capture_mutex);
+      split_lines(STDERR_FILENO);
       return stderr_lines.begin();
    }
 
    std::size_t Process::error_lc()
    //-----------------------------
    {
-      stderr_lines.clear();
-      split(stderr_raw, stderr_lines, "\n");
+      HandlerGuard guard(capture_mutex);
+      split_lines(STDERR_FILENO);
       return stderr_lines.size();
    }
 
    int Process::read_stream(int pipe, std::string& ss)
    //--------------------------------------------------------
    {
-      char buffer[4096];
-      int no = 0;
-      while (1) 
-      {
-         ssize_t count = read(pipe, buffer, sizeof(buffer));
-         if (count <= 0) break;
-         no += count;
-         buffer[count] = 0;
-         ss.append(buffer);
-      }
-      return no;
+      return read_pipe(pipe, ReadMode::eof, [&ss](const char* data, std::size_t len) { ss.append(data, len); });
+   }
+
+   int Process::drain_stream(int pipe, std::string& ss)
+   //--------------------------------------------------
+   {
+      return read_pipe(pipe, ReadMode::drain, [&ss](const char* data, std::size_t len) { ss.append(data, len); });
    }
 
    std::ostream& operator<<(std::ostream& ostr, const Process& o)
@@ -438,6 +2318,7 @@ namespace posix_util
                                                                                                 : wstatus) << std::endl;
 #endif
                   me->is_running = false;
+                  me->release_numa_node();
                   if (me->custom_async_child_death)
                   {
                      me->custom_async_child_death(signal, info, context);
@@ -464,10 +2345,13 @@ namespace posix_util
                      me->last_status = wstatus;
                   me->read_all_after_death();
                   me->on_child_death();
+                  notify_completion(sp);
                }
             }
             Process::outstanding_pids.erase(it);
          }
+         else if ( (spid > 0) && (registering > 0) && (wstatus != std::numeric_limits<int>::min()) )
+            unclaimed_exits[spid] = wstatus; // Claimed by the async_execute which forked it
          if (chain_handler != nullptr)
             (*chain_handler)(signal, info, context);
          spid = waitpid(-1, &wstatus, WNOHANG);  // Cater for batched signals
@@ -505,46 +2389,47 @@ namespace posix_util
       }
    }
 
-   std::size_t Process::split(std::string s, std::vector<std::string>& tokens, std::string delim)
-   //-----------------------------------------------------------------------------------
+   std::size_t Process::split(const std::string& s, std::vector<std::string>& tokens, const std::string& delim)
+   //--------------------------------------------------------------------------------------------------------
    {
+      std::vector<std::string_view> views;
+      LineSplitter::split(s, views, delim);
       tokens.clear();
-      std::size_t pos = s.find_first_not_of(delim);
-      while (pos != std::string::npos)
-      {
-         std::size_t next = s.find_first_of(delim, pos);
-         if (next == std::string::npos)
-         {
-            tokens.emplace_back(trim(s.substr(pos)));
-            break;
-         }
-         else
-         {
-            tokens.emplace_back(trim(s.substr(pos, next-pos)));
-            pos = s.find_first_not_of(delim, next);
-         }
-      }
+      tokens.reserve(views.size());
+      for (std::string_view v : views)
+         tokens.emplace_back(v);
       return tokens.size();
    }
 
-   std::string Process::trim(const std::string &str,  std::string chars)
-   //----------------------------------------------------------------
+   std::string Process::trim(const std::string &str,  const std::string& chars)
+   //--------------------------------------------------------------------------
+   {
+      return std::string(LineSplitter::trim(str, chars));
+   }
+
+   std::size_t Process::output_views(std::vector<std::string_view>& lines)
+   //---------------------------------------------------------------------
+   {
+      HandlerGuard guard(capture_mutex);
+      inflate(STDOUT_FILENO);
+      return LineSplitter::split(sealed_text(STDOUT_FILENO, stream_capture(STDOUT_FILENO).composed), lines);
+   }
+
+   std::size_t Process::error_views(std::vector<std::string_view>& lines)
+   //--------------------------------------------------------------------
    {
-      if (str.length() == 0)
-         return str;
-      auto b = str.find_first_not_of(chars);
-      auto e = str.find_last_not_of(chars);
-      if (b == std::string::npos) return "";
-      return std::string(str, b, e - b + 1);
+      HandlerGuard guard(capture_mutex);
+      inflate(STDERR_FILENO);
+      return LineSplitter::split(sealed_text(STDERR_FILENO, stream_capture(STDERR_FILENO).composed), lines);
    }
 
-   int Process::async_outstanding() { std::lock_guard<std::mutex> lock(Process::outstanding_mutex); return Process::outstanding_pids.size();  }
+   int Process::async_outstanding() { HandlerGuard lock(Process::outstanding_mutex); return Process::outstanding_pids.size();  }
 
    int Process::async_poll(std::vector<std::shared_ptr<Process>>& completed)
    //------------------------------------------------------------------
    {
       int n = 0;
-      std::lock_guard<std::mutex> lock(Process::outstanding_mutex);
+      HandlerGuard lock(Process::outstanding_mutex);
       for (auto it=Process::outstanding_pids.begin(); it!=Process::outstanding_pids.end(); )
       {
          auto pp = *it;
@@ -562,8 +2447,10 @@ namespace posix_util
             if (WIFEXITED(wstatus))
                sp->last_status = WEXITSTATUS(wstatus);
             sp->is_running = false;
+            sp->release_numa_node();
             sp->read_all_after_death();
             sp->on_child_death();
+            sp->unwatch_output();
             completed.push_back(sp);
          }
          it = Process::outstanding_pids.erase(it);
@@ -571,6 +2458,189 @@ namespace posix_util
       return n;
    }
 
+   int Process::notification_fd()
+   //----------------------------
+   {
+      HandlerGuard lock(Process::outstanding_mutex);
+      if (notify_epoll_fd >= 0)
+         return notify_epoll_fd;
+      int epfd = epoll_create1(EPOLL_CLOEXEC);
+      if (epfd < 0)
+      {
+         perror("epoll_create1");
+         return -1;
+      }
+      int evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (evfd < 0)
+      {
+         perror("eventfd");
+         close(epfd);
+         return -1;
+      }
+      struct epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.u64 = 0;
+      if (epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev) != 0)
+      {
+         perror("epoll_ctl");
+         close(evfd);
+         close(epfd);
+         return -1;
+      }
+      notify_event_fd = evfd;
+      notify_epoll_fd = epfd;
+      return epfd;
+   }
+
+   // Output pipes are registered with the pid in the upper bits and the stream in the lowest bit (0 is reserved
+   // for the completion eventfd).
+   void Process::watch_output()
+   //--------------------------
+   {
+      int epfd = notify_epoll_fd;
+      if ( (epfd < 0) || (is_background_drain) ) return; // Drained children notify through notify_output
+      struct epoll_event ev{};
+      ev.events = EPOLLIN;
+      if (stdout_pipe >= 0)
+      {
+         ev.data.u64 = (static_cast<std::uint64_t>(pid) << 1);
+         if (epoll_ctl(epfd, EPOLL_CTL_ADD, stdout_pipe, &ev) != 0)
+            perror("epoll_ctl (stdout)");
+      }
+      if (stderr_pipe >= 0)
+      {
+         ev.data.u64 = (static_cast<std::uint64_t>(pid) << 1) | 1;
+         if (epoll_ctl(epfd, EPOLL_CTL_ADD, stderr_pipe, &ev) != 0)
+            perror("epoll_ctl (stderr)");
+      }
+   }
+
+   void Process::unwatch_output()
+   //----------------------------
+   {
+      int epfd = notify_epoll_fd;
+      if ( (epfd < 0) || (is_background_drain) ) return;
+      if (stdout_pipe >= 0)
+         epoll_ctl(epfd, EPOLL_CTL_DEL, stdout_pipe, nullptr);
+      if (stderr_pipe >= 0)
+         epoll_ctl(epfd, EPOLL_CTL_DEL, stderr_pipe, nullptr);
+   }
+
+   // Completes (as the death handler would) an async child reaped before async_execute registered it
+   void Process::complete_unregistered(const std::shared_ptr<Process>& me, int wstatus)
+   //----------------------------------------------------------------------------------
+   {
+      is_running = false;
+      release_numa_node();
+      if (custom_async_child_death)
+      {
+         siginfo_t info{};
+         info.si_signo = SIGCHLD;
+         info.si_pid = pid;
+         info.si_code = (WIFEXITED(wstatus)) ? CLD_EXITED : CLD_KILLED;
+         info.si_status = (WIFEXITED(wstatus)) ? WEXITSTATUS(wstatus) : WTERMSIG(wstatus);
+         HandlerGuard lock(Process::outstanding_mutex);
+         custom_async_child_death(SIGCHLD, &info, nullptr);
+         return;
+      }
+      last_status = (WIFEXITED(wstatus)) ? WEXITSTATUS(wstatus) : wstatus;
+      read_all_after_death();
+      on_child_death();
+      HandlerGuard lock(Process::outstanding_mutex);
+      notify_completion(me);
+   }
+
+   // Called with outstanding_mutex held, possibly from the SIGCHLD handler. Nothing here allocates: the queue's
+   // capacity is reserved by async_execute when the child is registered and the eventfd write is signal safe.
+   void Process::notify_completion(const std::shared_ptr<Process>& sp)
+   //-----------------------------------------------------------------
+   {
+      int evfd = notify_event_fd;
+      if ( (evfd < 0) || (! sp) ) return;
+      sp->unwatch_output();
+      completed_queue.push_back(sp);
+      std::uint64_t one = 1;
+      if (write(evfd, &one, sizeof(one)) < 0)
+         perror("write (eventfd)");
+   }
+
+   // Called by the background drainer after reading output
+   void Process::notify_output(const std::shared_ptr<Process>& sp)
+   //-------------------------------------------------------------
+   {
+      int evfd = notify_event_fd;
+      if (evfd < 0) return;
+      {
+         std::lock_guard<std::mutex> lock(output_ready_mutex);
+         output_ready_queue.push_back(sp);
+      }
+      std::uint64_t one = 1;
+      if (write(evfd, &one, sizeof(one)) < 0)
+         perror("write (eventfd)");
+   }
+
+   int Process::async_drain(std::vector<std::shared_ptr<Process>>& completed, std::vector<std::shared_ptr<Process>>* output)
+   //----------------------------------------------------------------------------------------------------------------------
+   {
+      int epfd = notify_epoll_fd;
+      if (epfd < 0)
+         return async_poll(completed);
+      // A single pass, output still pending afterwards leaves the (level triggered) fd readable
+      struct epoll_event events[64];
+      int nevents = epoll_wait(epfd, events, 64, 0);
+      std::vector<std::pair<std::shared_ptr<Process>, int>> readable;
+      if (nevents > 0)
+      {
+         HandlerGuard lock(Process::outstanding_mutex);
+         for (int i=0; i<nevents; i++)
+         {
+            std::uint64_t key = events[i].data.u64;
+            if (key == 0) continue;
+            auto it = Process::outstanding_pids.find(static_cast<pid_t>(key >> 1));
+            if ( (it != Process::outstanding_pids.end()) && (it->second) )
+               readable.emplace_back(it->second, static_cast<int>(key & 1));
+         }
+      }
+      std::uint64_t count;
+      if ( (read(notify_event_fd, &count, sizeof(count)) < 0) && (errno != EAGAIN) )
+         perror("read (eventfd)");
+      for (auto& pr : readable)
+      {
+         std::shared_ptr<Process>& sp = pr.first;
+         int n = (pr.second == 0) ? sp->async_read_stdout() : sp->async_read_stderr();
+         if (n == 0) // EOF, stop polling it (the child is completed through the usual path)
+         {
+            int pipe = (pr.second == 0) ? sp->stdout_pipe : sp->stderr_pipe;
+            if (pipe >= 0) epoll_ctl(epfd, EPOLL_CTL_DEL, pipe, nullptr);
+         }
+         if ( (output != nullptr) && (n > 0) &&
+              (std::find(output->begin(), output->end(), sp) == output->end()) )
+            output->push_back(sp);
+      }
+      std::vector<std::weak_ptr<Process>> drained;
+      {
+         std::lock_guard<std::mutex> lock(output_ready_mutex);
+         drained.swap(output_ready_queue);
+      }
+      if (output != nullptr)
+      {
+         for (const std::weak_ptr<Process>& wp : drained)
+         {
+            std::shared_ptr<Process> sp = wp.lock();
+            if ( (sp) && (std::find(output->begin(), output->end(), sp) == output->end()) )
+               output->push_back(sp);
+         }
+      }
+      int n = 0;
+      {
+         HandlerGuard lock(Process::outstanding_mutex);
+         n = static_cast<int>(completed_queue.size());
+         completed.insert(completed.end(), completed_queue.begin(), completed_queue.end());
+         completed_queue.clear();
+      }
+      return n + async_poll(completed);
+   }
+
    void Process::async_custom_child_death_handler(std::function<void(int, siginfo_t*, void*)>& f)
    //-----------------------------------------------------------------------------------------------
    {
@@ -1,33 +1,162 @@
+#include <cstdint>
+#include <limits>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
 #include <ostream>
 #include <filesystem>
 #include <unordered_map>
 #include <csignal>
+#include <unistd.h>
+#include <sys/types.h>
 #include <functional>
 #include <atomic>
 #include <mutex>
+#include <memory>
 
 #ifndef _6c7d81a9037040a79526937efd1d5c63
 #define _6c7d81a9037040a79526937efd1d5c63
 namespace posix_util
 {
+   class MemFd;
+   class RecordDecoder;
+   class LineFilter;
+   struct ResultRegionHeader;
+   class OutputDrainer;
+   class NumaPlacement;
+
+   struct TerminationStage
+   {
+      int signal;
+      int grace_ms; // Time allowed for the child to exit after signal before escalating to the next stage
+   };
+   typedef std::vector<TerminationStage> TerminationLadder;
+
+   enum class ProcessGroup { inherit, new_group, new_session };
+
+   enum class Timeout { none, wall, idle };
+
+   enum class CaptureMode
+   {
+      separate,   // Separate stdout and stderr pipes
+      merged,     // One pipe for both (2>&1), all output is captured as stdout
+      timestamped // Separate pipes with each chunk read logged with its stream and CLOCK_MONOTONIC time
+   };
+
+   struct OutputChunk
+   {
+      std::int64_t timestamp_ns;
+      std::uint32_t length;
+      std::uint8_t stream; // STDOUT_FILENO or STDERR_FILENO, chunks are contiguous in their stream's buffer
+   };
+
+   // Destination receiving a live copy of a capture stream (see Process::set_tee). Pipe contents are duplicated
+   // in the kernel with tee(2) into a relay pipe which is spliced to fd, falling back to writing the captured
+   // copy where fd does not support splice (eg terminals or O_APPEND files).
+   struct TeeTarget
+   {
+      int fd = -1;
+      int relay[2] = { -1, -1 };
+      bool is_copy = false;
+      std::uint64_t spliced = 0, copied = 0;
+
+      TeeTarget() = default;
+      TeeTarget(const TeeTarget&) = delete;
+      TeeTarget& operator=(const TeeTarget&) = delete;
+      ~TeeTarget() { close(); }
+      bool open(int destination);
+      void close();
+      bool active() const { return (fd >= 0); }
+   };
+
+   // Target of a child's stdin, stdout or stderr set by Process::set_redirect in place of inheriting it or a
+   // capture pipe, so the parent does no I/O for the stream. Paths are opened in the child between fork and exec
+   // (a failure to open exits the child with status 1).
+   struct Redirect
+   {
+      enum class Kind { inherit, fd, path };
+      Kind kind = Kind::inherit;
+      int fd = -1;          // Parent fd (not owned, open until the child starts)
+      std::string path;
+      int flags = 0;        // open(2) flags and mode for path
+      mode_t mode = 0666;
+
+      static Redirect inherit() { return Redirect(); }
+      static Redirect to_fd(int fd);
+      static Redirect to_path(const std::string& path, int flags, mode_t mode = 0666);
+      static Redirect to_file(const std::string& path, bool is_append = false);
+      static Redirect from_file(const std::string& path);
+      static Redirect null();
+   };
+
+   // Placement and priority applied to a child between fork and exec (see Process::set_spawn_attributes). Fields
+   // left unset are inherited from the parent.
+   struct SpawnAttributes
+   {
+      static constexpr int unset = std::numeric_limits<int>::min();
+      std::vector<int> cpus;  // CPU affinity
+      int nice = unset;       // Absolute nice value (-20 to 19), lowering it requires privilege
+      int policy = unset;     // SCHED_OTHER, SCHED_BATCH or SCHED_IDLE
+      int io_class = unset;   // I/O priority class: 1 real time (requires privilege), 2 best effort or 3 idle
+      int io_level = 4;       // I/O priority within the real time and best effort classes, 0 (highest) to 7
+
+      bool is_set() const { return ( (! cpus.empty()) || (nice != unset) || (policy != unset) || (io_class != unset) ); }
+   };
+
+   // Callable run in a forked child by Process::sync_run/async_run. The child's serialized result is appended to
+   // result and the return value is its exit status.
+   typedef std::function<int(std::string& result)> ChildFunction;
+
+   enum class ReadMode
+   {
+      eof,   // Read until EOF
+      poll,  // Poll then read what is available (at most one read)
+      drain  // Read without blocking until no more is available
+   };
+
    class Process
    //=============
    {
       public:
          explicit Process(const char* pth) : Process(std::string(pth)) {};
          explicit Process(const std::string& pth);
+         // Executes an in-memory executable image (loaded once into a sealed memfd per image) using fexecve.
+         Process(const std::string& name, const void* image, std::size_t image_len);
+         // Process without an executable for sync_run/async_run
+         Process();
          Process(const Process& other) = delete;
          Process(const Process&& other) = delete;
+         virtual ~Process();
 
          bool sync_execute(std::vector<std::string>& args, bool is_stdout = false, bool is_stderr = false,
                            int timeout_ms = 0);
          bool async_execute(std::vector<std::string>& args, const std::shared_ptr<Process>& me,
                              bool is_stdout = false, bool is_stderr = false);
+         // Runs fn in a forked child instead of exec-ing the executable, isolating crash prone in-process code
+         // at the cost of a fork (no exec or reinitialization). The result fn produces is returned through a
+         // memfd and read by run_result() once the child completes. Capture, timeouts, kill and async completion
+         // are as for sync_execute/async_execute. Only the calling thread exists in the child so fn must not
+         // depend on locks held by other threads.
+         bool sync_run(const ChildFunction& fn, bool is_stdout = false, bool is_stderr = false, int timeout_ms = 0);
+         bool async_run(const ChildFunction& fn, const std::shared_ptr<Process>& me, bool is_stdout = false,
+                        bool is_stderr = false);
+         std::string run_result() const;
+         // Lets sync_execute emulate the command in process (no child) when Builtins has an emulation for it and
+         // the arguments, eg true, echo hello, cat file or test -f file. Only commands given by name are emulated,
+         // and only if the name is not on PATH or resolves to a system directory (/bin, /usr/bin, /sbin,
+         // /usr/sbin), so a project binary such as ./build/test or an earlier PATH entry is still executed.
+         // Features needing a real child (process groups, tees, side channels, result regions, inputs, stdin
+         // pipes, redirections, fd maps, spawn attributes, NUMA spreading, timestamped capture) always spawn.
+         void set_builtin(bool is_enabled = true);
          bool is_alive();
          bool running() const { return is_running; }
+         // Gives async children a stdin pipe written through stdin_fd() (closed by close_stdin or the next
+         // execution). stdout_fd() is the stdout capture pipe for callers speaking a protocol with the child.
+         void set_stdin_pipe(bool is_pipe = true) { is_stdin_pipe = is_pipe; }
+         int stdin_fd() const { return stdin_pipe; }
+         int stdout_fd() const { return stdout_pipe; }
+         void close_stdin();
 
          int async_read_stdout();
          int async_read_stderr();
@@ -41,29 +170,157 @@ namespace posix_util
          int status() const { return last_status; }
          pid_t get_pid() const { return pid; }
          std::string last_error_message() const { return last_error_mess; }
-         std::string raw_output() { return stdout_raw; }
-         std::string raw_error() { return stderr_raw; }
+         std::string raw_output();
+         std::string raw_error();
          std::vector<std::string>::iterator output_begin();
          std::vector<std::string>::iterator output_end() { return stdout_lines.end(); }
          std::size_t output_lc();
          std::vector<std::string>::iterator error_begin();
          std::vector<std::string>::iterator error_end() { return stderr_lines.end(); }
          std::size_t error_lc();
-         int kill();
+         // Trimmed lines as views into the captured output (valid until the output is next modified so for
+         // background drained children only once the child has completed)
+         std::size_t output_views(std::vector<std::string_view>& lines);
+         std::size_t error_views(std::vector<std::string_view>& lines);
+         // Places the child (and so its descendants) in its own process group or session. Signals and waits then
+         // apply to the whole tree and the child's output is drained without waiting for EOF once it exits, so
+         // background helpers holding the pipes open do not block completion. If exit_signal is non-zero it is
+         // sent to the remaining group members when the child exits.
+         void set_process_group(ProcessGroup mode, int exit_signal = 0) { process_group = mode; group_exit_signal = exit_signal; }
+         pid_t get_pgid() const { return pgid; }
+         int signal_group(int signal);
+         int wait_group(int timeout_ms = 0);
+         // Timeouts for children started by async_execute. wall_ms limits total run time while idle_ms limits the
+         // time without output being read. On expiry the child is terminated using ladder.
+         void set_timeouts(int wall_ms, int idle_ms = 0, const TerminationLadder& ladder = default_termination_ladder);
+         Timeout timed_out() const { return timeout_state; }
+         // Reads the capture pipes of children started by async_execute on a background thread as output
+         // arrives so that children never block on a full pipe.
+         void set_background_drain(bool is_drain = true) { is_background_drain = is_drain; }
+         // Compresses capture buffers of at least min_size bytes once the child completes (see CaptureCodec).
+         // Output is decompressed on access: raw_output, the line iterators and for_each_chunk decompress into
+         // temporaries while output_views/error_views decompress in place until compact is called again.
+         void set_capture_compression(bool is_compress = true, std::size_t min_size = 4096)
+         {
+            is_compress_captures = is_compress;
+            compress_min_size = min_size;
+         }
+         bool compact();
+         std::size_t capture_memory() const;
+         // Frees the capture buffers (and their CaptureBudget charge) once the output is no longer needed
+         void clear_captures();
+         // Bounds the capture of stream to its first head_bytes and last tail_bytes (0, 0 for unbounded). Output
+         // in between is counted (elided_bytes/elided_lines) and replaced by an elision marker line in raw_output,
+         // the line iterators and views. Decoders and timestamped chunks only see the head.
+         void set_capture_limit(int stream, std::size_t head_bytes, std::size_t tail_bytes);
+         std::size_t elided_bytes(int stream) const;
+         std::size_t elided_lines(int stream) const;
+         // Only stores the lines of stream for which filter returns true as output arrives, the others are
+         // counted by filtered_lines. Applied before decoders and capture limits. Lines are cut at
+         // max_filtered_line bytes (or the head plus tail of a capture limit if smaller), the rest up to the
+         // newline is dropped, so output without newlines is not held indefinitely.
+         void set_line_filter(int stream, std::shared_ptr<LineFilter> filter);
+         // Streams stream live to fd (eg a log file or STDOUT_FILENO) while it is captured, -1 to stop. fd is not
+         // owned and must remain open while the child runs.
+         bool set_tee(int stream, int fd);
+         const TeeTarget& tee_target(int stream) const { return captures[(stream == STDERR_FILENO) ? 1 : 0].tee; }
+         // Opens a framed (SOCK_SEQPACKET) channel on child_fd in the child for machine readable results (see
+         // SideChannel.hh for the child side), -1 to disable. Messages are received while output is captured (in
+         // sync_execute, by the background drainer or after death) and passed to on_message if set. Returns false
+         // (EINVAL) for child_fd 0-2 which are the child's standard streams.
+         bool set_side_channel(int child_fd = 3, std::function<void(std::string_view)> on_message = nullptr);
+         std::vector<std::string> messages() const;
+         int receive_messages();
+         // Allocates a shared memory (memfd) region for capacity bytes of results which is passed to the child on
+         // child_fd (see ResultRegion.hh for the child side), 0 removes it. result() is a view of the bytes
+         // published so far which remains valid until the next execution. child_fd 0-2 (the child's standard
+         // streams) is rejected with EINVAL.
+         bool set_result_region(std::size_t capacity, int child_fd = 4);
+         // Hands input to the child in a sealed memfd inherited on child_fd (0 for stdin) instead of a temporary
+         // file, returning the path the child can open it by (/proc/self/fd/<child_fd>) for path only tools
+         // (empty on error). map_input instead returns a writable mapping of len bytes to be filled in place,
+         // which is sealed by the next execution.
+         std::string set_input(std::string_view data, int child_fd = 0);
+         void* map_input(std::size_t len, int child_fd = 0);
+         void clear_inputs() { inputs.clear(); }
+         // Redirects stream (STDIN_FILENO, STDOUT_FILENO or STDERR_FILENO) of later executions, taking precedence
+         // over capture (is_stdout/is_stderr), stdin pipes and inputs for the stream
+         bool set_redirect(int stream, const Redirect& target);
+         // Applies attributes (CPU affinity, nice value, scheduling policy and I/O priority) to later children,
+         // returning false for out of range values. A child which cannot apply them exits with status 1.
+         bool set_spawn_attributes(const SpawnAttributes& attributes);
+         const SpawnAttributes& get_spawn_attributes() const { return spawn_attributes; }
+         // Spreads later children over the NUMA nodes (see NumaPlacement), binding each to the CPUs of the node
+         // with the fewest live children and preferring that node for its memory. No effect on single node
+         // machines. numa_node() is the node of the current child (-1 if unplaced). placement replaces
+         // NumaPlacement::instance() (eg a topology read from another sysfs root) and must outlive the children.
+         void set_numa_spread(bool is_spread = true, NumaPlacement* placement = nullptr)
+         {
+            is_numa_spread = is_spread;
+            numa_placement = placement;
+         }
+         int numa_node() const;
+         // Warms the page cache for the executable and its shared libraries (see ExecPrefetch) ahead of a burst of
+         // executions, returning false if the executable could not be read. Nothing to do for in-memory images.
+         bool prefetch() const;
+         // Passes parent_fd to the child as child_fd (eg a pipe end connecting children or an open file), taking
+         // precedence over capture pipes for the same fd. parent_fd is not owned and must stay open until the
+         // child has started.
+         void map_fd(int parent_fd, int child_fd) { mapped_fds.emplace_back(parent_fd, child_fd); }
+         void clear_fd_maps() { mapped_fds.clear(); }
+         std::string_view result() const;
+         bool result_complete() const;
+         // Waits until at least min_bytes are published, the child completes the region or the child is no longer
+         // running, returning the bytes published (timeout_ms <= 0 waits indefinitely).
+         std::size_t wait_result(std::size_t min_bytes, int timeout_ms = 0) const;
+         std::size_t filtered_lines(int stream) const;
+         void set_capture_mode(CaptureMode mode) { capture_mode = mode; }
+         CaptureMode get_capture_mode() const { return capture_mode; }
+         const std::vector<OutputChunk>& chunk_log() const { return chunks; }
+         // Visits the timestamped chunks in the order they were read as views into the capture buffers
+         void for_each_chunk(const std::function<void(const OutputChunk&, std::string_view)>& visitor) const;
+         std::string interleaved_output() const;
+         // Decodes records from the stdout (STDOUT_FILENO) or stderr (STDERR_FILENO) capture incrementally as
+         // output arrives, passing each to on_record as a view into the capture buffer. If is_discard then
+         // decoded output is removed from the capture buffer (so raw_output() only retains undecoded output).
+         void set_decoder(int stream, std::shared_ptr<RecordDecoder> decoder,
+                          std::function<void(std::string_view)> on_record, bool is_discard = false);
+         int kill(const TerminationLadder& ladder = default_termination_ladder);
+         bool kill_async(const std::shared_ptr<Process>& me,
+                         const TerminationLadder& ladder = default_termination_ladder);
          int read_all_after_death();
 
          friend std::ostream& operator<<(std::ostream& ostr, const Process &o);
 
          static int timed_waitpid(pid_t pid, int timeout_ms);
 //         static bool nonblocking(int pipe);
+         static int read_pipe(int pipe, ReadMode mode, const std::function<void(const char*, std::size_t)>& sink,
+                              int timeout_ms = 0, bool* is_eof = nullptr, TeeTarget* tee = nullptr);
          static int read_stream(int pipe, std::string& raw);
+         static int drain_stream(int pipe, std::string& raw);
          static int async_read_stream(int pipe, std::string& raw, int timeout_ms=0);
          static void default_child_death_handler(int signal, siginfo_t* info, void * context);
          static void set_child_death_handler(void (*handler)(int, siginfo_t*, void *) = nullptr);
-         static std::string trim(const std::string &str,  std::string chars  = " \t");
-         static std::size_t split(std::string s, std::vector<std::string>& tokens, std::string delim);
+         static std::string trim(const std::string &str,  const std::string& chars  = " \t");
+         static std::size_t split(const std::string& s, std::vector<std::string>& tokens, const std::string& delim);
          static int async_outstanding();
          static int async_poll(std::vector<std::shared_ptr<Process>>& completed);
+         // A single pollable (epoll) fd for external event loops which becomes readable when a child started by
+         // async_execute (after the first call) completes or has output available. async_drain then collects the
+         // completed children and reads the available output (returning the children it was read for in output).
+         // Once the fd exists completed children are queued until drained.
+         static int notification_fd();
+         static int async_drain(std::vector<std::shared_ptr<Process>>& completed,
+                                std::vector<std::shared_ptr<Process>>* output = nullptr);
+         static bool set_child_subreaper(bool is_subreaper = true);
+         static int kill_all(const std::vector<std::shared_ptr<Process>>& processes,
+                             const TerminationLadder& ladder = default_termination_ladder);
+
+         static TerminationLadder default_termination_ladder;
+         static constexpr int side_channel_stream = 3; // Stream id of the side channel for the capture helpers
+         static constexpr std::size_t max_filtered_line = 1024 * 1024;
+
+         static std::shared_ptr<MemFd> load_image(const std::string& name, const void* image, std::size_t image_len);
 
          static std::unordered_map<pid_t, std::shared_ptr<Process>> outstanding_pids;
          static std::mutex child_handler_mutex;
@@ -79,14 +336,113 @@ namespace posix_util
          bool is_search_path;
          pid_t pid;
          int stdout_pipe, stderr_pipe;
+         int side_fd, side_child_fd;
+         bool is_stdin_pipe;
+         int stdin_pipe;
+         std::function<void(std::string_view)> on_side_message;
+         std::vector<std::string> side_messages;
+         std::shared_ptr<MemFd> result_memfd;
+         int result_child_fd;
+         std::vector<std::pair<int, std::shared_ptr<MemFd>>> inputs; // child fd, sealed input
+         std::vector<std::pair<int, int>> mapped_fds; // Parent fd, child fd
+         Redirect redirects[3]; // stdin, stdout, stderr
+         SpawnAttributes spawn_attributes;
+         bool is_numa_spread;
+         NumaPlacement* numa_placement; // nullptr for NumaPlacement::instance()
+         std::atomic<int> numa_index; // NumaPlacement node index of the running child
+         NumaPlacement* numa_placed; // Placement numa_index was acquired from
          std::string stdout_raw, stderr_raw;
          std::vector<std::string> stdout_lines, stderr_lines;   
          int last_status, last_err;
          std::string last_error_mess;
          bool is_running;
          std::function<void(int, siginfo_t *si, void *)> custom_async_child_death;
+         std::shared_ptr<MemFd> image;
+         ChildFunction child_function; // Set only while sync_run/async_run fork
+         std::shared_ptr<MemFd> run_memfd;
+         std::string builtin_name; // Command emulated by Builtins, empty if not enabled or not eligible
+         ProcessGroup process_group;
+         int group_exit_signal;
+         pid_t pgid;
+         int wall_timeout_ms, idle_timeout_ms;
+         TerminationLadder timeout_ladder;
+         std::atomic<Timeout> timeout_state;
+         std::atomic<std::int64_t> last_activity_ms;
+
+         struct StreamCapture
+         {
+            std::shared_ptr<RecordDecoder> decoder;
+            std::function<void(std::string_view)> on_record;
+            std::size_t decoded = 0;
+            bool is_discard = false;
+            std::string compressed;
+            std::size_t original_size = 0;
+            bool is_bounded = false;
+            std::size_t head_limit = 0;
+            std::string tail; // Ring of the most recent output beyond the head
+            std::size_t tail_pos = 0, tail_fill = 0;
+            std::size_t elided_bytes = 0, elided_lines = 0;
+            std::string composed; // Bounded output presented to output_views/error_views
+            std::shared_ptr<LineFilter> filter;
+            std::string partial_line; // Filtered output after the last newline
+            std::size_t filtered_lines = 0;
+            TeeTarget tee;
+         };
+         StreamCapture captures[2]; // stdout, stderr
+         CaptureMode capture_mode;
+         std::vector<OutputChunk> chunks;
+         bool is_background_drain;
+         bool is_compress_captures;
+         std::size_t compress_min_size;
+         mutable std::mutex capture_mutex; // Guards the capture buffers and pipes against the background drainer
+         std::atomic<std::size_t> budget_charged; // Capture memory accounted in CaptureBudget
+
+         void output_activity();
+         int capture_stream(int stream, ReadMode mode, int timeout_ms = 0);
+         int capture_streams();
+         virtual void append_output(int stream, const char* data, std::size_t len);
+         void store_output(int stream, const char* data, std::size_t len);
+         void finish_output();
+         void reset_captures();
+         bool deflate(int stream);
+         void inflate(int stream);
+         std::string_view sealed_text(int stream, std::string& scratch) const;
+         void split_lines(int stream);
+         void account();
+         int receive_side(bool is_wait);
+         ResultRegionHeader* result_header() const;
+         std::size_t result_committed(const ResultRegionHeader* region) const;
+         std::shared_ptr<MemFd> new_input(int child_fd, std::size_t len);
+         static void push_tail(StreamCapture& capture, const char* data, std::size_t len);
+         std::vector<std::string>& line_buffer(int stream) { return (stream == STDERR_FILENO) ? stderr_lines : stdout_lines; }
+         std::string& raw_buffer(int stream) { return (stream == STDERR_FILENO) ? stderr_raw : stdout_raw; }
+         const std::string& raw_buffer(int stream) const { return (stream == STDERR_FILENO) ? stderr_raw : stdout_raw; }
+         int& stream_pipe(int stream)
+         {
+            return (stream == side_channel_stream) ? side_fd : (stream == STDERR_FILENO) ? stderr_pipe : stdout_pipe;
+         }
+         StreamCapture& stream_capture(int stream) { return captures[(stream == STDERR_FILENO) ? 1 : 0]; }
 
       private:
+         friend class OutputDrainer;
+
+         void init();
+         bool prepare_run(const ChildFunction& fn);
+         int run_child();
+         void release_numa_node();
+         bool run_builtin(const std::vector<std::string>& args, bool is_stdout, bool is_stderr);
+         bool drain_output(int stream, int fd);
+         void close_output(int stream, int fd);
+         static void notify_output(const std::shared_ptr<Process>& sp);
+         int wait_leader(bool is_stdout, bool is_stderr, int timeout_ms);
+         void start_timeouts(const std::shared_ptr<Process>& me);
+         bool is_unreaped_alive() const;
+         static void idle_check(std::weak_ptr<Process> wp);
+         void watch_output();
+         void unwatch_output();
+         static void notify_completion(const std::shared_ptr<Process>& sp);
+         void complete_unregistered(const std::shared_ptr<Process>& me, int wstatus);
+         static void terminate_stage(std::weak_ptr<Process> wp, TerminationLadder ladder, std::size_t stage);
          bool fork_exec(std::vector<std::string>& args, bool is_stdout, bool is_stderr, int& stdout, int& stderr);
    };
 }
@@ -0,0 +1,77 @@
+#include <cstring>
+
+#include "RecordDecoder.hh"
+
+namespace posix_util
+{
+   std::size_t DelimitedDecoder::decode(std::string_view data, bool is_eof, const record_callback& on_record)
+   //--------------------------------------------------------------------------------------------------------
+   {
+      std::size_t consumed = 0;
+      while (consumed < data.size())
+      {
+         const void* p = std::memchr(data.data() + consumed, delimiter, data.size() - consumed);
+         if (p == nullptr)
+            break;
+         std::size_t end = static_cast<const char*>(p) - data.data();
+         on_record(data.substr(consumed, end - consumed));
+         consumed = end + 1;
+      }
+      if ( (is_eof) && (consumed < data.size()) )
+      {
+         on_record(data.substr(consumed));
+         consumed = data.size();
+      }
+      return consumed;
+   }
+
+   std::size_t LengthPrefixedDecoder::decode(std::string_view data, bool is_eof, const record_callback& on_record)
+   //-------------------------------------------------------------------------------------------------------------
+   {
+      std::size_t consumed = 0;
+      while (data.size() - consumed >= header_len)
+      {
+         const unsigned char* header = reinterpret_cast<const unsigned char*>(data.data() + consumed);
+         std::uint64_t len = 0;
+         for (std::size_t i=0; i<header_len; i++)
+         {
+            std::size_t byte = (big_endian) ? i : header_len - 1 - i;
+            len = (len << 8) | header[byte];
+         }
+         if (data.size() - consumed - header_len < len)
+            break;
+         on_record(data.substr(consumed + header_len, static_cast<std::size_t>(len)));
+         consumed += header_len + static_cast<std::size_t>(len);
+      }
+      if (is_eof)
+         consumed = data.size();
+      return consumed;
+   }
+
+   std::size_t JsonLinesDecoder::decode(std::string_view data, bool is_eof, const record_callback& on_record)
+   //--------------------------------------------------------------------------------------------------------
+   {
+      std::size_t consumed = 0;
+      auto emit = [&on_record](std::string_view line)
+      {
+         if ( (! line.empty()) && (line.back() == '\r') )
+            line.remove_suffix(1);
+         if (line.find_first_not_of(" \t") != std::string_view::npos)
+            on_record(line);
+      };
+      while (consumed < data.size())
+      {
+         std::size_t end = data.find('\n', consumed);
+         if (end == std::string_view::npos)
+            break;
+         emit(data.substr(consumed, end - consumed));
+         consumed = end + 1;
+      }
+      if ( (is_eof) && (consumed < data.size()) )
+      {
+         emit(data.substr(consumed));
+         consumed = data.size();
+      }
+      return consumed;
+   }
+}
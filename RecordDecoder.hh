@@ -0,0 +1,61 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+#ifndef _e2a7c4b19f3d4c6a8b0e5d7f1a3c9b26
+#define _e2a7c4b19f3d4c6a8b0e5d7f1a3c9b26
+namespace posix_util
+{
+   // Incremental decoder for structured child output attached to a Process capture stream (see
+   // Process::set_decoder). decode is called with the not yet decoded part of the capture buffer each time
+   // output arrives and returns the number of bytes consumed by complete records, each of which is passed to
+   // on_record as a view into the capture buffer (only valid for the duration of the call).
+   class RecordDecoder
+   //=================
+   {
+   public:
+      typedef std::function<void(std::string_view)> record_callback;
+
+      virtual ~RecordDecoder() = default;
+      virtual std::size_t decode(std::string_view data, bool is_eof, const record_callback& on_record) = 0;
+   };
+
+   // Records terminated by a delimiter byte eg find -print0 (NUL) output. A trailing unterminated record is
+   // emitted at EOF.
+   class DelimitedDecoder : public RecordDecoder
+   //============================================
+   {
+   public:
+      explicit DelimitedDecoder(char delim = '\0') : delimiter(delim) {}
+      std::size_t decode(std::string_view data, bool is_eof, const record_callback& on_record) override;
+
+   private:
+      char delimiter;
+   };
+
+   // Records preceded by an unsigned binary length of header_size (1, 2, 4 or 8) bytes. A truncated record at
+   // EOF is discarded.
+   class LengthPrefixedDecoder : public RecordDecoder
+   //=================================================
+   {
+   public:
+      explicit LengthPrefixedDecoder(std::size_t header_size = 4, bool is_big_endian = true)
+         : header_len(header_size), big_endian(is_big_endian) {}
+      std::size_t decode(std::string_view data, bool is_eof, const record_callback& on_record) override;
+
+   private:
+      std::size_t header_len;
+      bool big_endian;
+   };
+
+   // JSON Lines: one JSON value per newline terminated line. Records are framed only (not parsed), blank lines
+   // are skipped and a trailing carriage return is removed.
+   class JsonLinesDecoder : public RecordDecoder
+   //============================================
+   {
+   public:
+      std::size_t decode(std::string_view data, bool is_eof, const record_callback& on_record) override;
+   };
+}
+#endif
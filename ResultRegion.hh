@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef _5a8e2c0f4b1d4a7e9c3f6d8b0e2a4c71
+#define _5a8e2c0f4b1d4a7e9c3f6d8b0e2a4c71
+namespace posix_util
+{
+   // Layout of the start of a shared memory result region (see Process::set_result_region). The child appends
+   // results after the header and publishes them by advancing committed, then increments sequence (the futex
+   // word) to wake a waiting parent.
+   struct ResultRegionHeader
+   {
+      static constexpr std::uint32_t MAGIC = 0x52525031; // RRP1
+      static constexpr std::size_t SIZE = 64;
+
+      std::uint32_t magic;
+      std::uint32_t header_size;
+      std::uint64_t capacity; // Bytes available for results after the header
+      std::atomic<std::uint64_t> committed;
+      std::atomic<std::uint32_t> sequence;
+      std::atomic<std::uint32_t> is_complete;
+
+      void reset(std::uint64_t result_capacity)
+      {
+         magic = MAGIC;
+         header_size = SIZE;
+         capacity = result_capacity;
+         committed.store(0, std::memory_order_relaxed);
+         is_complete.store(0, std::memory_order_relaxed);
+         sequence.store(0, std::memory_order_release);
+      }
+
+      void publish()
+      {
+         sequence.fetch_add(1, std::memory_order_acq_rel);
+         syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&sequence), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+      }
+
+      // Waits for sequence to change from seen (false on timeout), timeout_ms <= 0 waits indefinitely
+      bool wait(std::uint32_t seen, int timeout_ms) const
+      {
+         struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+         long ret = syscall(SYS_futex, reinterpret_cast<const std::uint32_t*>(&sequence), FUTEX_WAIT, seen,
+                            (timeout_ms > 0) ? &ts : nullptr, nullptr, 0);
+         return ( (ret == 0) || (errno != ETIMEDOUT) );
+      }
+   };
+   static_assert(sizeof(ResultRegionHeader) <= ResultRegionHeader::SIZE, "ResultRegionHeader too large");
+   static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "Futex word must be lock free");
+   static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Committed count must be lock free");
+
+   // Child side of Process::set_result_region. Results are either appended (copied) or written in place at
+   // next() and then published with commit.
+   class ResultRegion
+   //================
+   {
+   public:
+      explicit ResultRegion(int region_fd = 4)
+      {
+         struct stat st;
+         if ( (fstat(region_fd, &st) != 0) || (static_cast<std::size_t>(st.st_size) < ResultRegionHeader::SIZE) )
+            return;
+         void* p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, region_fd, 0);
+         if (p == MAP_FAILED)
+            return;
+         header = static_cast<ResultRegionHeader*>(p);
+         mapped_len = static_cast<std::size_t>(st.st_size);
+         if (header->magic != ResultRegionHeader::MAGIC)
+         {
+            munmap(p, mapped_len);
+            header = nullptr;
+         }
+      }
+      ~ResultRegion() { if (header != nullptr) munmap(header, mapped_len); }
+      ResultRegion(const ResultRegion&) = delete;
+      ResultRegion& operator=(const ResultRegion&) = delete;
+
+      bool available() const { return (header != nullptr); }
+      // Bounded by the mapping as the header is shared with the parent
+      std::size_t capacity() const
+      {
+         return (header != nullptr) ? std::min<std::size_t>(header->capacity, mapped_len - ResultRegionHeader::SIZE) : 0;
+      }
+      std::size_t remaining() const
+      {
+         if (header == nullptr) return 0;
+         std::size_t committed = header->committed.load();
+         return (committed < capacity()) ? capacity() - committed : 0;
+      }
+
+      // Where the next result bytes are to be written in place (up to remaining() bytes)
+      char* next() const
+      {
+         if (header == nullptr) return nullptr;
+         return reinterpret_cast<char*>(header) + ResultRegionHeader::SIZE + header->committed.load(std::memory_order_relaxed);
+      }
+
+      bool commit(std::size_t len)
+      {
+         if ( (header == nullptr) || (len > remaining()) )
+            return false;
+         header->committed.fetch_add(len, std::memory_order_release);
+         header->publish();
+         return true;
+      }
+
+      bool append(std::string_view data)
+      {
+         if ( (header == nullptr) || (data.size() > remaining()) )
+            return false;
+         std::memcpy(next(), data.data(), data.size());
+         return commit(data.size());
+      }
+
+      void finish()
+      {
+         if (header == nullptr) return;
+         header->is_complete.store(1, std::memory_order_release);
+         header->publish();
+      }
+
+   private:
+      ResultRegionHeader* header = nullptr;
+      std::size_t mapped_len = 0;
+   };
+}
+#endif
@@ -0,0 +1,45 @@
+#include <cerrno>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#ifndef _c94f1a2e7d3b4e8f0a6b5c1d2e9f7a43
+#define _c94f1a2e7d3b4e8f0a6b5c1d2e9f7a43
+namespace posix_util
+{
+   // Child side of Process::set_side_channel. Each send is received by the parent as one discrete message.
+   class SideChannel
+   //===============
+   {
+   public:
+      explicit SideChannel(int channel_fd = 3) : fd(channel_fd) {}
+
+      // True if fd is an open SOCK_SEQPACKET socket (ie the parent opened a side channel)
+      bool available() const
+      {
+         int type = 0;
+         socklen_t len = sizeof(type);
+         return ( (fcntl(fd, F_GETFD) >= 0) && (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0) &&
+                  (type == SOCK_SEQPACKET) );
+      }
+
+      // Empty messages are not sent as the parent cannot distinguish them from EOF
+      bool send(std::string_view message) const
+      {
+         if (message.empty())
+            return false;
+         while (true)
+         {
+            ssize_t n = ::send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+            if (n >= 0)
+               return (static_cast<std::size_t>(n) == message.size());
+            if (errno != EINTR)
+               return false;
+         }
+      }
+
+   private:
+      int fd;
+   };
+}
+#endif
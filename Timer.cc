@@ -0,0 +1,200 @@
+#include <csignal>
+#include <cstdio>
+#include <vector>
+
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "Timer.hh"
+
+namespace posix_util
+{
+   Timer& Timer::instance()
+   //----------------------
+   {
+      static Timer timer;
+      return timer;
+   }
+
+   Timer::Timer() : base(0), start(clock::now()), next_id(1)
+   //--------------------------------------------------------
+   {
+      timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (timer_fd < 0)
+         perror("timerfd_create");
+      wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (wake_fd < 0)
+         perror("eventfd (Timer)");
+      worker = std::thread(&Timer::run, this);
+   }
+
+   Timer::~Timer()
+   //-------------
+   {
+      std::uint64_t one = 1;
+      if (write(wake_fd, &one, sizeof(one)) < 0)
+         perror("write (Timer wake)");
+      if (worker.joinable())
+         worker.join();
+      close(timer_fd);
+      close(wake_fd);
+   }
+
+   std::uint64_t Timer::now_tick() const
+   //-----------------------------------
+   {
+      return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count()) / tick_ms;
+   }
+
+   void Timer::arm(bool is_ticking)
+   //------------------------------
+   {
+      struct itimerspec spec{};
+      if (is_ticking)
+      {
+         spec.it_value.tv_nsec = spec.it_interval.tv_nsec = tick_ms * 1000000L;
+      }
+      if (timerfd_settime(timer_fd, 0, &spec, nullptr) != 0)
+         perror("timerfd_settime");
+   }
+
+   Timer::timer_id Timer::schedule(int delay_ms, std::function<void()> callback)
+   //--------------------------------------------------------------------------
+   {
+      if (delay_ms < 0) delay_ms = 0;
+      std::lock_guard<std::mutex> lock(mtx);
+      std::uint64_t now_ms = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count());
+      if (entries.empty()) // The wheel does not turn while idle so catch up
+         base = now_ms / tick_ms;
+      std::uint64_t expiry = (now_ms + delay_ms + tick_ms - 1) / tick_ms; // Round up so a timer never fires early
+      timer_id id = next_id++;
+      Entry& entry = entries[id];
+      entry.expiry = expiry;
+      entry.callback = std::move(callback);
+      add(id);
+      if (entries.size() == 1)
+         arm(true);
+      return id;
+   }
+
+   bool Timer::cancel(timer_id id)
+   //-----------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = entries.find(id);
+      if (it == entries.end())
+         return false;
+      it->second.slot->erase(it->second.position);
+      entries.erase(it);
+      if (entries.empty())
+         arm(false);
+      return true;
+   }
+
+   std::size_t Timer::pending() { std::lock_guard<std::mutex> lock(mtx); return entries.size(); }
+
+   void Timer::add(timer_id id)
+   //--------------------------
+   {
+      Entry& entry = entries[id];
+      std::uint64_t expiry = entry.expiry;
+      Slot* slot;
+      if (expiry < base)
+         slot = &wheels[0][base & wheel_mask];
+      else
+      {
+         std::uint64_t delta = expiry - base;
+         if (delta < (1ULL << wheel_bits))
+            slot = &wheels[0][expiry & wheel_mask];
+         else if (delta < (1ULL << (2*wheel_bits)))
+            slot = &wheels[1][(expiry >> wheel_bits) & wheel_mask];
+         else if (delta < (1ULL << (3*wheel_bits)))
+            slot = &wheels[2][(expiry >> (2*wheel_bits)) & wheel_mask];
+         else
+         {
+            if (delta >= (1ULL << (4*wheel_bits)))
+               expiry = base + (1ULL << (4*wheel_bits)) - 1;
+            slot = &wheels[3][(expiry >> (3*wheel_bits)) & wheel_mask];
+         }
+      }
+      entry.slot = slot;
+      entry.position = slot->insert(slot->end(), id);
+   }
+
+   std::size_t Timer::cascade(int level, std::size_t index)
+   //------------------------------------------------------
+   {
+      Slot moving;
+      moving.swap(wheels[level][index]);
+      for (timer_id id : moving)
+         add(id);
+      return index;
+   }
+
+   void Timer::expire(std::uint64_t upto, std::vector<std::function<void()>>& expired)
+   //---------------------------------------------------------------------------------
+   {
+      while ( (base <= upto) && (! entries.empty()) )
+      {
+         std::size_t index = base & wheel_mask;
+         if ( (index == 0) &&
+              (cascade(1, (base >> wheel_bits) & wheel_mask) == 0) &&
+              (cascade(2, (base >> (2*wheel_bits)) & wheel_mask) == 0) )
+            cascade(3, (base >> (3*wheel_bits)) & wheel_mask);
+         base++;
+         Slot due;
+         due.swap(wheels[0][index]);
+         for (timer_id id : due)
+         {
+            auto it = entries.find(id);
+            if (it == entries.end()) continue;
+            expired.push_back(std::move(it->second.callback));
+            entries.erase(it);
+         }
+      }
+      if (entries.empty())
+      {
+         base = upto + 1;
+         arm(false);
+      }
+   }
+
+   void Timer::run()
+   //---------------
+   {
+      sigset_t mask;
+      sigemptyset(&mask);
+      sigaddset(&mask, SIGCHLD);
+      if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
+         perror("pthread_sigmask (Timer)");
+      std::vector<std::function<void()>> expired;
+      while (true)
+      {
+         struct pollfd fds[2] = { {timer_fd, POLLIN, 0}, {wake_fd, POLLIN, 0} };
+         int ret = poll(fds, 2, -1);
+         if (ret < 0)
+         {
+            if (errno == EINTR) continue;
+            perror("poll (Timer)");
+            break;
+         }
+         if (fds[1].revents & POLLIN)
+            break;
+         if ((fds[0].revents & POLLIN) == 0)
+            continue;
+         std::uint64_t ticks;
+         if (read(timer_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+            continue;
+         {
+            std::lock_guard<std::mutex> lock(mtx);
+            expire(now_tick(), expired);
+         }
+         for (auto& callback : expired)
+            callback();
+         expired.clear();
+      }
+   }
+}
@@ -0,0 +1,68 @@
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+
+#ifndef _9b4d2e7f10c84a3e8d5f6a2c71e0b9d4
+#define _9b4d2e7f10c84a3e8d5f6a2c71e0b9d4
+namespace posix_util
+{
+   // Shared one-shot timer facility implemented as a hierarchical timer wheel (4 levels of 256 slots) driven by
+   // a single timerfd which only ticks while timers are pending. Scheduling, cancelling and expiring a timer are
+   // O(1) and a tick only touches the current slot (plus an occasional cascade from an outer level).
+   // Callbacks execute on a single library thread (which has SIGCHLD blocked) so they should be short and must
+   // not block.
+   class Timer
+   //=========
+   {
+   public:
+      typedef std::uint64_t timer_id;
+      typedef std::chrono::steady_clock clock;
+      static constexpr int tick_ms = 10;
+
+      static Timer& instance();
+      ~Timer();
+      Timer(const Timer& other) = delete;
+      Timer& operator=(const Timer& other) = delete;
+
+      timer_id schedule(int delay_ms, std::function<void()> callback);
+      bool cancel(timer_id id);
+      std::size_t pending();
+
+   private:
+      Timer();
+      void run();
+      void add(timer_id id);
+      std::size_t cascade(int level, std::size_t index);
+      void expire(std::uint64_t upto, std::vector<std::function<void()>>& expired);
+      std::uint64_t now_tick() const;
+      void arm(bool is_ticking);
+
+      static constexpr int wheel_bits = 8;
+      static constexpr std::size_t wheel_size = 1 << wheel_bits;
+      static constexpr std::size_t wheel_mask = wheel_size - 1;
+      static constexpr int levels = 4;
+      typedef std::list<timer_id> Slot;
+
+      struct Entry
+      {
+         std::uint64_t expiry;
+         std::function<void()> callback;
+         Slot* slot;
+         Slot::iterator position;
+      };
+      Slot wheels[levels][wheel_size];
+      std::unordered_map<timer_id, Entry> entries;
+      std::uint64_t base; // Next tick to be processed
+      clock::time_point start;
+      timer_id next_id;
+      int timer_fd, wake_fd;
+      std::mutex mtx;
+      std::thread worker;
+   };
+}
+#endif
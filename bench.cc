@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "Process.hh"
+#include "LineSplitter.hh"
+#include "CaptureCodec.hh"
+
+// Usage: benchmarks [MB]
+// Output is intended to be redirected to bench_output.txt
+
+static std::string make_output(std::size_t bytes)
+//-----------------------------------------------
+{
+   std::string s;
+   s.reserve(bytes + 128);
+   unsigned int i = 0;
+   while (s.size() < bytes)
+   {
+      s += "  [INFO] worker ";
+      s += std::to_string(i % 64);
+      s += " processed record ";
+      s += std::to_string(i++);
+      s += " in 0.0042s\n";
+   }
+   return s;
+}
+
+static std::size_t legacy_split(std::string s, std::vector<std::string>& tokens, std::string delim)
+//-----------------------------------------------------------------------------------------------
+{
+   tokens.clear();
+   std::size_t pos = s.find_first_not_of(delim);
+   while (pos != std::string::npos)
+   {
+      std::size_t next = s.find_first_of(delim, pos);
+      std::string token = (next == std::string::npos) ? s.substr(pos) : s.substr(pos, next - pos);
+      tokens.emplace_back(posix_util::Process::trim(token));
+      if (next == std::string::npos) break;
+      pos = s.find_first_not_of(delim, next);
+   }
+   return tokens.size();
+}
+
+template <typename F>
+static double seconds(F f)
+//------------------------
+{
+   auto start = std::chrono::steady_clock::now();
+   f();
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* name, std::size_t bytes, double secs, std::size_t count)
+//--------------------------------------------------------------------------------------
+{
+   std::cout << name << ": " << secs * 1000 << " ms, " << (bytes / secs) / 1e9 << " GB/s (" << count << " lines)" << std::endl;
+}
+
+static void bench_split(std::size_t mb)
+//-------------------------------------
+{
+   std::string output = make_output(mb * 1024 * 1024);
+   std::cout << "== split " << output.size() / (1024*1024) << " MB (" << posix_util::LineSplitter::simd_level()
+             << ", " << std::thread::hardware_concurrency() << " threads)" << std::endl;
+   std::vector<std::string> tokens;
+   std::size_t n = 0;
+   double secs = seconds([&]() { n = legacy_split(output, tokens, "\n"); });
+   report("legacy split (find_first_of, substr, trim)", output.size(), secs, n);
+   secs = seconds([&]() { n = posix_util::Process::split(output, tokens, "\n"); });
+   report("Process::split (strings)", output.size(), secs, n);
+   std::vector<std::string_view> views;
+   std::size_t threshold = posix_util::LineSplitter::parallel_threshold;
+   posix_util::LineSplitter::parallel_threshold = static_cast<std::size_t>(-1);
+   secs = seconds([&]() { n = posix_util::LineSplitter::split(output, views); });
+   report("LineSplitter::split (views, single thread)", output.size(), secs, n);
+   posix_util::LineSplitter::parallel_threshold = threshold;
+   secs = seconds([&]() { n = posix_util::LineSplitter::split(output, views); });
+   report("LineSplitter::split (views, parallel)", output.size(), secs, n);
+}
+
+static void bench_compression(std::size_t mb)
+//-------------------------------------------
+{
+   std::string output = make_output(mb * 1024 * 1024);
+   std::cout << "== capture compression " << output.size() / (1024*1024) << " MB ("
+             << posix_util::CaptureCodec::name() << ")" << std::endl;
+   if (! posix_util::CaptureCodec::available())
+      return;
+   std::string compressed, restored;
+   double secs = seconds([&]() { posix_util::CaptureCodec::compress(output, compressed); });
+   std::cout << "compress: " << secs * 1000 << " ms, " << (output.size() / secs) / 1e9 << " GB/s, "
+             << output.size() << " -> " << compressed.size() << " bytes (" << (100.0 * compressed.size()) / output.size()
+             << "%)" << std::endl;
+   secs = seconds([&]() { posix_util::CaptureCodec::decompress(compressed, output.size(), restored); });
+   std::cout << "decompress: " << secs * 1000 << " ms, " << (output.size() / secs) / 1e9 << " GB/s"
+             << ((restored == output) ? "" : " (MISMATCH)") << std::endl;
+}
+
+static void bench_builtins(std::size_t runs)
+//------------------------------------------
+{
+   std::cout << "== builtin commands vs spawn (" << runs << " runs each)" << std::endl;
+   std::vector<std::pair<std::string, std::vector<std::string>>> commands =
+      { { "true", {} }, { "echo", { "hello", "world" } }, { "test", { "-d", "/tmp" } } };
+   for (auto& command : commands)
+   {
+      for (bool is_builtin : { false, true })
+      {
+         posix_util::Process process(command.first);
+         process.set_builtin(is_builtin);
+         double secs = seconds([&]()
+         {
+            for (std::size_t i = 0; i < runs; i++)
+               process.sync_execute(command.second, true);
+         });
+         std::cout << command.first << ((is_builtin) ? " (builtin): " : " (spawn): ") << (secs * 1e6) / runs
+                   << " us/run" << std::endl;
+      }
+   }
+}
+
+int main(int argc, char** argv)
+//-----------------------------
+{
+   std::size_t mb = 256;
+   if (argc > 1)
+      mb = std::strtoul(argv[1], nullptr, 10);
+   bench_split(mb);
+   bench_compression(mb);
+   bench_builtins(1000);
+   return 0;
+}
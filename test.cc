@@ -4,11 +4,29 @@
 
 #include <thread>
 #include <array>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <elf.h>
 //#include <latch> // C++20
 #include "Latch.hh" // C++11 & 14 or use experimental latch
 #include "Process.hh"
 #include "TmpFile.hh"
 #include "NamedSemaphore.hh"
+#include "Timer.hh"
+#include "LineSplitter.hh"
+#include "RecordDecoder.hh"
+#include "CaptureCodec.hh"
+#include "LineFilter.hh"
+#include "CaptureBudget.hh"
+#include "CoProcessPool.hh"
+#include "Builtins.hh"
+#include "CommandLine.hh"
+#include "NumaPlacement.hh"
+#include "ExecPrefetch.hh"
 
 
 void thread_run(std::shared_ptr<posix_util::Process> ptester_process, Latch* latch)
@@ -37,6 +55,20 @@ void thread_run(std::shared_ptr<posix_util::Process> ptester_process, Latch* lat
       std::this_thread::sleep_for(std::chrono::milliseconds(300));
 }
 
+// First CPU in the affinity mask (CPU 0 is not necessarily usable, eg in a container limited to other CPUs)
+int allowed_cpu()
+//---------------
+{
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   if (sched_getaffinity(0, sizeof(set), &set) == 0)
+   {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+         if (CPU_ISSET(cpu, &set)) return cpu;
+   }
+   return 0;
+}
+
 TEST_CASE( "synchronous tests", "[sync]" )
 {
    posix_util::Process tester_process("./cmake-build-debug/tester");
@@ -55,6 +87,20 @@ TEST_CASE( "synchronous tests", "[sync]" )
       sleep_process.sync_execute(args, false, false, 1000);
       REQUIRE(sleep_process.status() == std::numeric_limits<int>::min());
       sleep_process.kill();
+      // Killing a sync child whose pipe a grandchild keeps open must not block the timer thread
+      std::shared_ptr<posix_util::Process> psh = std::make_shared<posix_util::Process>("sh");
+      args = { "-c", "sleep 3 & exec sleep 30" };
+      std::thread runner([psh, args]() mutable { psh->sync_execute(args, true); });
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      REQUIRE(psh->kill_async(psh, { {SIGTERM, 100}, {SIGKILL, 0} }));
+      std::this_thread::sleep_for(std::chrono::milliseconds(300)); // The second stage has run
+      std::atomic_bool is_fired{false};
+      auto start = std::chrono::steady_clock::now();
+      posix_util::Timer::instance().schedule(10, [&is_fired]() { is_fired = true; });
+      while ( (! is_fired) && (std::chrono::steady_clock::now() - start < std::chrono::seconds(2)) )
+         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      runner.join();
+      REQUIRE(is_fired);
       std::cout << "Simple time out complete" << std::endl;
    }
    SECTION( "stdout single line" )
@@ -98,8 +144,576 @@ TEST_CASE( "synchronous tests", "[sync]" )
          REQUIRE(*it == ss.str());
       }
       REQUIRE(tester_process.status() == 0);
+      // With only two fds left the stdout pipe is created and the stderr pipe fails, neither may leak
+      std::vector<int> free_fds;
+      for (int fd = 0; free_fds.size() < 2; fd++)
+         if (fcntl(fd, F_GETFD) == -1) free_fds.push_back(fd);
+      auto open_fds = []()
+      {
+         return std::distance(std::filesystem::directory_iterator("/proc/self/fd"), std::filesystem::directory_iterator());
+      };
+      auto fds_before = open_fds();
+      struct rlimit saved;
+      REQUIRE(getrlimit(RLIMIT_NOFILE, &saved) == 0);
+      struct rlimit limited = saved;
+      limited.rlim_cur = static_cast<rlim_t>(free_fds[1] + 1);
+      REQUIRE(setrlimit(RLIMIT_NOFILE, &limited) == 0);
+      bool is_started = tester_process.sync_execute(args, true, true);
+      REQUIRE(setrlimit(RLIMIT_NOFILE, &saved) == 0);
+      REQUIRE(! is_started);
+      REQUIRE(tester_process.last_error_message() == "Creating pipe for stderr");
+      REQUIRE(open_fds() == fds_before);
       std::cout << "stdout,stderr multiple lines" << std::endl;
    }
+   SECTION( "Process group with background descendants" )
+   {
+      REQUIRE(posix_util::Process::set_child_subreaper(true));
+      posix_util::Process sh_process("sh");
+      sh_process.set_process_group(posix_util::ProcessGroup::new_group);
+      std::vector<std::string> args = {  "-c", "sleep 30 & echo started" };
+      auto start = std::chrono::steady_clock::now();
+      REQUIRE(sh_process.sync_execute(args, true, false, 10000));
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      REQUIRE(elapsed.count() < 5000);
+      REQUIRE(sh_process.raw_output() == "started\n");
+      REQUIRE(sh_process.get_pgid() > 0);
+      REQUIRE(sh_process.signal_group(SIGKILL) == 0);
+      REQUIRE(sh_process.wait_group(5000) >= 0);
+      REQUIRE(::kill(-sh_process.get_pgid(), 0) == -1);
+      auto open_fds = []()
+      {
+         return std::distance(std::filesystem::directory_iterator("/proc/self/fd"), std::filesystem::directory_iterator());
+      };
+      auto fds_before = open_fds();
+      args = {  "-c", "sleep 30" };
+      REQUIRE(! sh_process.sync_execute(args, true, true, 100)); // Times out, pipes must not leak
+      REQUIRE(open_fds() == fds_before);
+      REQUIRE(sh_process.signal_group(SIGKILL) == 0);
+      REQUIRE(sh_process.wait_group(5000) >= 0);
+      posix_util::Process::set_child_subreaper(false);
+      std::cout << "Process group with background descendants complete" << std::endl;
+   }
+   SECTION( "Record decoders" )
+   {
+      posix_util::Process printf_process("printf");
+      std::vector<std::string> records;
+      printf_process.set_decoder(STDOUT_FILENO, std::make_shared<posix_util::DelimitedDecoder>(),
+                                 [&records](std::string_view r) { records.emplace_back(r); }, true);
+      std::vector<std::string> args = {  "one\\0two words\\0\\0three" };
+      REQUIRE(printf_process.sync_execute(args, true));
+      REQUIRE(records == std::vector<std::string>{ "one", "two words", "", "three" });
+      REQUIRE(printf_process.raw_output().empty());
+
+      records.clear();
+      printf_process.set_decoder(STDOUT_FILENO, std::make_shared<posix_util::LengthPrefixedDecoder>(2),
+                                 [&records](std::string_view r) { records.emplace_back(r); });
+      args = {  "\\000\\003abc\\000\\000\\000\\005hello\\000\\011trunc" };
+      REQUIRE(printf_process.sync_execute(args, true));
+      REQUIRE(records == std::vector<std::string>{ "abc", "", "hello" });
+      REQUIRE(printf_process.raw_output().size() == 21);
+
+      records.clear();
+      posix_util::Process tester_process("./cmake-build-debug/tester");
+      tester_process.set_decoder(STDOUT_FILENO, std::make_shared<posix_util::JsonLinesDecoder>(),
+                                 [&records](std::string_view r) { records.emplace_back(r); });
+      args = {  "0", "{\"a\": 1}\n\n  \n[1, 2]\r\n\"x\"" };
+      REQUIRE(tester_process.sync_execute(args, true));
+      REQUIRE(records == std::vector<std::string>{ "{\"a\": 1}", "[1, 2]", "\"x\"" });
+      std::cout << "Record decoders complete" << std::endl;
+   }
+   SECTION( "Merged and timestamped capture" )
+   {
+      posix_util::Process sh_process("sh");
+      sh_process.set_capture_mode(posix_util::CaptureMode::merged);
+      std::vector<std::string> args = {  "-c", "echo a; echo b 1>&2; echo c" };
+      REQUIRE(sh_process.sync_execute(args, true, true));
+      REQUIRE(sh_process.raw_output() == "a\nb\nc\n");
+      REQUIRE(sh_process.raw_error().empty());
+
+      std::stringstream ss, expected;
+      for (int i=1; i<5; i++)
+      {
+         ss << "Line " << i << std::endl;
+         expected << "Line " << i << std::endl << "Line " << i << std::endl;
+      }
+      tester_process.set_capture_mode(posix_util::CaptureMode::timestamped);
+      args = {  "0",  ss.str(), ss.str(), "0", "50" };
+      REQUIRE(tester_process.sync_execute(args, true, true));
+      REQUIRE(tester_process.interleaved_output() == expected.str());
+      REQUIRE(tester_process.chunk_log().size() >= 8);
+      std::int64_t last = 0;
+      int last_stream = -1, runs = 0;
+      tester_process.for_each_chunk([&last, &last_stream, &runs](const posix_util::OutputChunk& chunk, std::string_view data)
+      {
+         REQUIRE(chunk.timestamp_ns >= last);
+         REQUIRE(data.size() == chunk.length);
+         if (chunk.stream != last_stream) runs++;
+         last = chunk.timestamp_ns;
+         last_stream = chunk.stream;
+      });
+      REQUIRE(runs == 8);
+      std::cout << "Merged and timestamped capture complete" << std::endl;
+   }
+   SECTION( "In-memory executable image" )
+   {
+      std::ifstream in("./cmake-build-debug/tester", std::ios::binary);
+      std::vector<char> exe((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+      REQUIRE(exe.size() > 0);
+      posix_util::Process image_process("tester", exe.data(), exe.size());
+      REQUIRE(image_process.last_error() == 0);
+      std::vector<std::string> args = {  "7", "from memfd" };
+      REQUIRE(! image_process.sync_execute(args, true));
+      REQUIRE(image_process.status() == 7);
+      REQUIRE(image_process.raw_output() == "from memfd\n");
+      posix_util::Process image_process2("tester", exe.data(), exe.size());
+      args = {  "0" };
+      REQUIRE(image_process2.sync_execute(args));
+      std::fill(exe.begin(), exe.end(), 'x'); // Same buffer and length, different image
+      posix_util::Process image_process3("tester", exe.data(), exe.size());
+      REQUIRE(! image_process3.sync_execute(args));
+      std::cout << "In-memory executable image complete" << std::endl;
+   }
+   SECTION( "Compressed captures" )
+   {
+      posix_util::Process seq_process("seq");
+      seq_process.set_capture_compression(true);
+      std::vector<std::string> args = {  "1", "200000" };
+      REQUIRE(seq_process.sync_execute(args, true));
+      std::size_t compacted = seq_process.capture_memory();
+      std::string raw = seq_process.raw_output();
+      REQUIRE(raw.size() == 1288895);
+      REQUIRE(raw.substr(0, 6) == "1\n2\n3\n");
+      if (posix_util::CaptureCodec::available())
+         REQUIRE(compacted < raw.size() / 2);
+      int count = 0;
+      for (auto it = seq_process.output_begin(); it != seq_process.output_end(); ++it)
+         count++;
+      REQUIRE(count == 200000);
+      std::vector<std::string_view> views;
+      REQUIRE(seq_process.output_views(views) == 200000);
+      REQUIRE(views.back() == "200000");
+      REQUIRE(seq_process.compact() == posix_util::CaptureCodec::available());
+      REQUIRE(seq_process.raw_output() == raw);
+      std::cout << "Compressed captures complete" << std::endl;
+   }
+   SECTION( "Bounded head and tail capture" )
+   {
+      posix_util::Process seq_process("seq");
+      seq_process.set_capture_limit(STDOUT_FILENO, 12, 13);
+      std::vector<std::string> args = {  "1", "100000" };
+      REQUIRE(seq_process.sync_execute(args, true));
+      REQUIRE(seq_process.elided_bytes(STDOUT_FILENO) == 588895 - 25);
+      REQUIRE(seq_process.raw_output() == "1\n2\n3\n4\n5\n6\n[... " + std::to_string(588895 - 25) +
+                                          " bytes (99992 lines) elided ...]\n99999\n100000\n");
+      REQUIRE(seq_process.capture_memory() < 1024);
+      auto it = seq_process.output_begin();
+      std::vector<std::string> lines(it, seq_process.output_end());
+      REQUIRE(lines.size() == 9);
+      REQUIRE(lines[0] == "1");
+      REQUIRE(lines[8] == "100000");
+      std::vector<std::string_view> views;
+      REQUIRE(seq_process.output_views(views) == 9);
+      REQUIRE(views[7] == "99999");
+      std::cout << "Bounded head and tail capture complete" << std::endl;
+   }
+   SECTION( "Capture line filtering" )
+   {
+      posix_util::LineFilter overlapping({ "she", "he", "hers" });
+      REQUIRE(overlapping.matches("ushers"));
+      REQUIRE(overlapping.matches("the"));
+      REQUIRE(! overlapping.matches("hs es"));
+      posix_util::LineFilter filter({ "99" }, "^5[0-9]$");
+      posix_util::Process seq_process("seq");
+      seq_process.set_line_filter(STDOUT_FILENO, std::make_shared<posix_util::LineFilter>(filter));
+      std::vector<std::string> args = {  "1", "1000" };
+      REQUIRE(seq_process.sync_execute(args, true));
+      REQUIRE(seq_process.output_lc() == 29);
+      REQUIRE(seq_process.filtered_lines(STDOUT_FILENO) == 1000 - 29);
+      REQUIRE(*seq_process.output_begin() == "50");
+      posix_util::Process sh_process("sh");
+      sh_process.set_line_filter(STDOUT_FILENO,
+                                 std::make_shared<posix_util::LineFilter>(std::vector<std::string>{ "warn" }));
+      args = {  "-c", "printf 'warn a\\nok\\nwarn b'" };
+      REQUIRE(sh_process.sync_execute(args, true));
+      REQUIRE(sh_process.raw_output() == "warn a\nwarn b");
+      REQUIRE(sh_process.filtered_lines(STDOUT_FILENO) == 1);
+      args = {  "-c", "printf warn; head -c 3000000 /dev/zero | tr '\\000' w; echo; echo warn end" }; // Cut
+      REQUIRE(sh_process.sync_execute(args, true));
+      REQUIRE(sh_process.raw_output() ==
+              "warn" + std::string(posix_util::Process::max_filtered_line - 4, 'w') + "\nwarn end\n");
+      std::cout << "Capture line filtering complete" << std::endl;
+   }
+   SECTION( "Tee output to files" )
+   {
+      posix_util::TmpFile spliced_file("tee");
+      posix_util::TmpFile appended_file("tee");
+      int spliced_fd = open(spliced_file.path(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+      int appended_fd = open(appended_file.path(), O_WRONLY | O_TRUNC | O_APPEND | O_CLOEXEC);
+      REQUIRE(spliced_fd >= 0);
+      REQUIRE(appended_fd >= 0);
+      posix_util::Process seq_process("seq");
+      REQUIRE(seq_process.set_tee(STDOUT_FILENO, spliced_fd));
+      std::vector<std::string> args = {  "1", "100000" };
+      REQUIRE(seq_process.sync_execute(args, true));
+      REQUIRE(seq_process.tee_target(STDOUT_FILENO).spliced == 588895);
+      REQUIRE(seq_process.set_tee(STDOUT_FILENO, appended_fd));
+      REQUIRE(seq_process.sync_execute(args, true));
+      REQUIRE(seq_process.tee_target(STDOUT_FILENO).is_copy); // splice does not support O_APPEND
+      close(spliced_fd);
+      close(appended_fd);
+      std::string raw = seq_process.raw_output();
+      REQUIRE(raw.size() == 588895);
+      for (const char* path : { spliced_file.path(), appended_file.path() })
+      {
+         std::ifstream in(path, std::ios::binary);
+         std::string teed((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+         REQUIRE(teed == raw);
+      }
+      std::cout << "Tee output to files complete" << std::endl;
+   }
+   SECTION( "Side channel messages" )
+   {
+      posix_util::Process tester_process("./cmake-build-debug/tester");
+      std::vector<std::string> received;
+      REQUIRE(! tester_process.set_side_channel(STDOUT_FILENO));
+      REQUIRE(tester_process.last_error() == EINVAL);
+      REQUIRE(tester_process.set_side_channel(3, [&received](std::string_view message) { received.emplace_back(message); }));
+      std::vector<std::string> args = {  "3", "first\nsecond" };
+      REQUIRE(! tester_process.sync_execute(args, true));
+      REQUIRE(tester_process.status() == 3);
+      REQUIRE(tester_process.raw_output() == "first\nsecond\n");
+      std::vector<std::string> expected = { "line=first", "line=second", "status=3" };
+      REQUIRE(tester_process.messages() == expected);
+      REQUIRE(received == expected);
+      tester_process.set_side_channel(-1);
+      REQUIRE(! tester_process.sync_execute(args, true));
+      REQUIRE(tester_process.messages().empty());
+      std::cout << "Side channel messages complete" << std::endl;
+   }
+   SECTION( "Shared memory result region" )
+   {
+      posix_util::Process tester_process("./cmake-build-debug/tester");
+      REQUIRE(! tester_process.set_result_region(4096, STDOUT_FILENO));
+      REQUIRE(tester_process.last_error() == EINVAL);
+      REQUIRE(tester_process.set_result_region(256 * 1024 * 1024));
+      std::vector<std::string> args = {  "0", "row 1\nrow 2" };
+      REQUIRE(tester_process.sync_execute(args));
+      REQUIRE(tester_process.result_complete());
+      REQUIRE(tester_process.result() == "row 1\nrow 2\n");
+      args = {  "0", "row 3" };
+      REQUIRE(tester_process.sync_execute(args));
+      REQUIRE(tester_process.result() == "row 3\n");
+      std::cout << "Shared memory result region complete" << std::endl;
+   }
+   SECTION( "Memfd input handoff" )
+   {
+      posix_util::Process tester_process("./cmake-build-debug/tester");
+      std::stringstream ss;
+      for (int i=1; i< 10; i++)
+         ss << "Output " << i << std::endl;
+      std::string stdout_path = tester_process.set_input(ss.str(), 5);
+      REQUIRE(stdout_path == "/proc/self/fd/5");
+      const char error_text[] = "Error 1\nError 2\n";
+      char* mapped = static_cast<char*>(tester_process.map_input(sizeof(error_text) - 1, 6));
+      REQUIRE(mapped != nullptr);
+      std::memcpy(mapped, error_text, sizeof(error_text) - 1);
+      std::vector<std::string> args = {  "0", stdout_path, "/proc/self/fd/6" };
+      REQUIRE(tester_process.sync_execute(args, true, true));
+      REQUIRE(tester_process.raw_output() == ss.str());
+      REQUIRE(tester_process.raw_error() == error_text);
+      posix_util::Process cat_process("cat");
+      cat_process.set_input("via stdin\n");
+      std::vector<std::string> no_args;
+      for (int i=0; i<2; i++) // Second run checks the input is rewound
+      {
+         REQUIRE(cat_process.sync_execute(no_args, true));
+         REQUIRE(cat_process.raw_output() == "via stdin\n");
+      }
+      std::cout << "Memfd input handoff complete" << std::endl;
+   }
+   SECTION( "Run function in child" )
+   {
+      posix_util::Process runner;
+      REQUIRE(runner.sync_run([](std::string& result)
+      {
+         std::cout << "from child" << std::endl;
+         result = "answer=42";
+         return 0;
+      }, true));
+      REQUIRE(runner.status() == 0);
+      REQUIRE(runner.raw_output() == "from child\n");
+      REQUIRE(runner.run_result() == "answer=42");
+      REQUIRE(! runner.sync_run([](std::string& result)
+      {
+         result = "partial";
+         raise(SIGKILL); // Crash without the Catch signal handlers reporting from the child
+         return 0;
+      }));
+      REQUIRE(runner.run_result().empty());
+      REQUIRE(! runner.sync_run([](std::string&) -> int { throw std::runtime_error("parse error"); }, false, true));
+      REQUIRE(runner.status() == EXIT_FAILURE);
+      REQUIRE(runner.raw_error().find("parse error") != std::string::npos);
+      std::cout << "Run function in child complete" << std::endl;
+   }
+   SECTION( "Redirection without pipes" )
+   {
+      std::string file = "./cmake-build-debug/redirect-test.txt";
+      posix_util::Process echo("echo");
+      REQUIRE(echo.set_redirect(STDOUT_FILENO, posix_util::Redirect::to_file(file)));
+      std::vector<std::string> args = { "one" };
+      REQUIRE(echo.sync_execute(args, true));
+      REQUIRE(echo.raw_output().empty());
+      REQUIRE(echo.set_redirect(STDOUT_FILENO, posix_util::Redirect::to_file(file, true)));
+      args = { "two" };
+      REQUIRE(echo.sync_execute(args, true));
+      posix_util::Process cat("cat");
+      REQUIRE(cat.set_redirect(STDIN_FILENO, posix_util::Redirect::from_file(file)));
+      std::vector<std::string> no_args;
+      REQUIRE(cat.sync_execute(no_args, true));
+      REQUIRE(cat.raw_output() == "one\ntwo\n");
+      int fd = open(file.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+      REQUIRE(fd >= 0);
+      posix_util::Process ls("ls");
+      REQUIRE(ls.set_redirect(STDOUT_FILENO, posix_util::Redirect::to_fd(fd)));
+      REQUIRE(ls.set_redirect(STDERR_FILENO, posix_util::Redirect::null()));
+      args = { file, "/nonexistent" };
+      REQUIRE(! ls.sync_execute(args, true, true));
+      close(fd);
+      REQUIRE(ls.status() == 2);
+      REQUIRE(ls.raw_output().empty());
+      REQUIRE(ls.raw_error().empty());
+      REQUIRE(cat.sync_execute(no_args, true));
+      REQUIRE(cat.raw_output() == file + "\n");
+      REQUIRE(cat.set_redirect(STDIN_FILENO, posix_util::Redirect::from_file("/nonexistent")));
+      REQUIRE(cat.set_redirect(STDERR_FILENO, posix_util::Redirect::null()));
+      REQUIRE(! cat.sync_execute(no_args, true));
+      REQUIRE(cat.status() == 1);
+      REQUIRE(! cat.set_redirect(3, posix_util::Redirect::null()));
+      posix_util::Process sh("sh");
+      int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+      REQUIRE(null_fd >= 0);
+      for (int child_fd = 10; child_fd < 90; child_fd++) // More mappings than fit a fixed buffer
+         sh.map_fd(null_fd, child_fd);
+      args = { "-c", "[ -e /proc/self/fd/10 ] && [ -e /proc/self/fd/89 ]" };
+      REQUIRE(sh.sync_execute(args));
+      sh.map_fd(1000000, 90); // Not open in the parent, the child must fail rather than run without it
+      REQUIRE(! sh.sync_execute(args, false, true));
+      REQUIRE(sh.status() == 1);
+      close(null_fd);
+      std::filesystem::remove(file);
+      std::cout << "Redirection without pipes complete" << std::endl;
+   }
+   SECTION( "Spawn attributes" )
+   {
+      posix_util::SpawnAttributes attributes;
+      int cpu = allowed_cpu();
+      attributes.cpus = { cpu };
+      attributes.nice = 5;
+      attributes.policy = SCHED_BATCH;
+      posix_util::Process cat("cat");
+      REQUIRE(cat.set_spawn_attributes(attributes));
+      std::vector<std::string> args = { "/proc/self/stat", "/proc/self/status" };
+      REQUIRE(cat.sync_execute(args, true));
+      std::string stat = *cat.output_begin();
+      std::vector<std::string> fields;
+      posix_util::Process::split(stat.substr(stat.rfind(')') + 2), fields, " ");
+      REQUIRE(fields.at(16) == "5");  // nice (field 19)
+      REQUIRE(fields.at(38) == std::to_string(SCHED_BATCH)); // policy (field 41)
+      REQUIRE(cat.raw_output().find("Cpus_allowed_list:\t" + std::to_string(cpu) + "\n") != std::string::npos);
+      posix_util::Process ionice("ionice");
+      attributes = posix_util::SpawnAttributes();
+      attributes.io_class = 3;
+      REQUIRE(ionice.set_spawn_attributes(attributes));
+      std::vector<std::string> no_args;
+      REQUIRE(ionice.sync_execute(no_args, true));
+      REQUIRE(ionice.raw_output() == "idle\n");
+      attributes.io_class = 2;
+      attributes.io_level = 7;
+      REQUIRE(ionice.set_spawn_attributes(attributes));
+      REQUIRE(ionice.sync_execute(no_args, true));
+      REQUIRE(ionice.raw_output() == "best-effort: prio 7\n");
+      attributes.io_level = 8;
+      REQUIRE(! ionice.set_spawn_attributes(attributes));
+      attributes = posix_util::SpawnAttributes();
+      attributes.nice = 20;
+      REQUIRE(! ionice.set_spawn_attributes(attributes));
+      attributes.nice = posix_util::SpawnAttributes::unset;
+      attributes.cpus = { -1 };
+      REQUIRE(! ionice.set_spawn_attributes(attributes));
+      std::cout << "Spawn attributes complete" << std::endl;
+   }
+   SECTION( "NUMA placement" )
+   {
+      REQUIRE(posix_util::NumaPlacement::parse_cpulist("0-3,8,10-11\n") == std::vector<int>{ 0, 1, 2, 3, 8, 10, 11 });
+      REQUIRE(posix_util::NumaPlacement::parse_cpulist("").empty());
+      std::filesystem::path root = "./cmake-build-debug/numa-test";
+      for (const char* node : { "node0", "node1", "node2" })
+         std::filesystem::create_directories(root / node);
+      int cpu = allowed_cpu();
+      std::ofstream(root / "node0" / "cpulist") << cpu << std::endl;
+      std::ofstream(root / "node1" / "cpulist") << cpu << std::endl;
+      std::ofstream(root / "node2" / "cpulist") << std::endl; // Memory only
+      posix_util::NumaPlacement placement(root.string());
+      REQUIRE(placement.nodes() == 2);
+      REQUIRE(placement.node(1).id == 1);
+      REQUIRE(placement.acquire() == 0);
+      REQUIRE(placement.acquire() == 1);
+      REQUIRE(placement.acquire() == 0);
+      placement.release(0);
+      placement.release(0);
+      REQUIRE(placement.live(0) == 0);
+      REQUIRE(placement.live(1) == 1);
+      REQUIRE(placement.acquire() == 0);
+      std::filesystem::remove_all(root);
+      posix_util::Process bound("cat"); // Spread over the simulated nodes
+      bound.set_numa_spread(true, &placement);
+      std::vector<std::string> status_args = { "/proc/self/status" };
+      REQUIRE(bound.sync_execute(status_args, true));
+      REQUIRE(bound.raw_output().find("Cpus_allowed_list:\t" + std::to_string(cpu) + "\n") != std::string::npos);
+      REQUIRE(placement.live(0) == 1);
+      REQUIRE(placement.live(1) == 1);
+
+      posix_util::NumaPlacement& host = posix_util::NumaPlacement::instance();
+      posix_util::Process sleeper("sleep");
+      sleeper.set_numa_spread();
+      std::vector<std::string> args = { "0.2" };
+      REQUIRE(sleeper.sync_execute(args));
+      REQUIRE(sleeper.numa_node() == -1);
+      if (host.nodes() > 1)
+      {
+         for (std::size_t i = 0; i < host.nodes(); i++)
+            REQUIRE(host.live(i) == 0);
+      }
+      std::cout << "NUMA placement complete" << std::endl;
+   }
+
+   SECTION( "Executable prefetch" )
+   {
+      posix_util::ExecPrefetch::ElfInfo info;
+      REQUIRE(posix_util::ExecPrefetch::read_elf("/bin/ls", info));
+      REQUIRE(! info.interpreter.empty());
+      REQUIRE(std::find(info.needed.begin(), info.needed.end(), "libc.so.6") != info.needed.end());
+
+      posix_util::ExecPrefetch::Result result;
+      REQUIRE(posix_util::ExecPrefetch::prefetch("ls", &result));
+      REQUIRE(std::filesystem::path(result.files[0]).filename() == "ls");
+      REQUIRE(std::find(result.files.begin(), result.files.end(), info.interpreter) != result.files.end());
+      REQUIRE(std::any_of(result.files.begin(), result.files.end(), [](const std::string& file)
+                          { return std::filesystem::path(file).filename() == "libc.so.6"; }));
+      REQUIRE(result.missing.empty());
+      REQUIRE(result.bytes > 0);
+      REQUIRE(! posix_util::ExecPrefetch::prefetch("/nonexistent/command", &result));
+      REQUIRE(! posix_util::ExecPrefetch::prefetch("no-such-command-on-path"));
+      REQUIRE(! posix_util::ExecPrefetch::read_elf("/etc/passwd", info));
+      std::string elf; // A dynamic section claiming to be larger than the file fails rather than being allocated
+      {
+         std::ifstream ifs("/bin/ls", std::ios::binary);
+         elf.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+      }
+      REQUIRE(elf[EI_CLASS] == ELFCLASS64);
+      Elf64_Ehdr header;
+      std::memcpy(&header, elf.data(), sizeof(header));
+      for (int i = 0; i < header.e_phnum; i++)
+      {
+         Elf64_Phdr segment;
+         std::size_t offset = header.e_phoff + i * sizeof(segment);
+         std::memcpy(&segment, elf.data() + offset, sizeof(segment));
+         if (segment.p_type == PT_DYNAMIC)
+         {
+            segment.p_filesz = std::uint64_t(1) << 40;
+            std::memcpy(&elf[offset], &segment, sizeof(segment));
+         }
+      }
+      std::string corrupt = "./cmake-build-debug/corrupt-elf";
+      std::ofstream(corrupt, std::ios::binary) << elf;
+      REQUIRE(! posix_util::ExecPrefetch::read_elf(corrupt, info));
+      std::filesystem::remove(corrupt);
+
+      posix_util::Process ls("ls");
+      REQUIRE(ls.prefetch());
+      std::cout << "Executable prefetch complete" << std::endl;
+   }
+
+   SECTION( "Builtin commands" )
+   {
+      std::string file = "./cmake-build-debug/builtin-test.txt";
+      {
+         std::ofstream ofs(file);
+         ofs << "line 1\nline 2" << std::endl;
+      }
+      std::vector<std::pair<std::string, std::vector<std::string>>> commands =
+      {
+         { "true", {} }, { "false", {} }, { "echo", { "hello", "world" } }, { "echo", { "-n", "no", "newline" } },
+         { "echo", { "-nE", "-x" } }, { "cat", { file, "/nonexistent", file } }, { "test", { "-f", file } },
+         { "test", { "-d", file } }, { "test", { "!", "-e", "/nonexistent" } }, { "test", { "12", "-lt", "9" } },
+         { "test", { "abc", "=", "abc" } }, { "test", { "" } }
+      };
+      for (auto& command : commands)
+      {
+         posix_util::Process real(command.first), builtin(command.first);
+         builtin.set_builtin();
+         REQUIRE(real.sync_execute(command.second, true, true) == builtin.sync_execute(command.second, true, true));
+         REQUIRE(builtin.get_pid() == -1);
+         REQUIRE(real.status() == builtin.status());
+         REQUIRE(real.raw_output() == builtin.raw_output());
+         REQUIRE(real.raw_error() == builtin.raw_error());
+      }
+      posix_util::Process escapes("echo"); // Not emulated so spawned
+      escapes.set_builtin();
+      std::vector<std::string> args = { "-e", "a\\tb" };
+      REQUIRE(escapes.sync_execute(args, true));
+      REQUIRE(escapes.get_pid() > 0);
+      REQUIRE(escapes.raw_output() == "a\tb\n");
+      std::string project_true = "./cmake-build-debug/true"; // A project binary named like a builtin
+      std::filesystem::remove(project_true);
+      std::filesystem::create_symlink(std::filesystem::absolute("./cmake-build-debug/tester"), project_true);
+      posix_util::Process shadowed(project_true);
+      shadowed.set_builtin();
+      args = { "3" };
+      REQUIRE(! shadowed.sync_execute(args, true));
+      REQUIRE(shadowed.get_pid() > 0);
+      REQUIRE(shadowed.status() == 3);
+      std::filesystem::remove(project_true);
+      posix_util::Process mapped("echo"); // Output must go to the mapped fd, so spawned
+      mapped.set_builtin();
+      int fd = open(file.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+      REQUIRE(fd >= 0);
+      mapped.map_fd(fd, STDOUT_FILENO);
+      args = { "to", "file" };
+      REQUIRE(mapped.sync_execute(args));
+      close(fd);
+      REQUIRE(mapped.get_pid() > 0);
+      {
+         std::ifstream ifs(file);
+         std::string line;
+         REQUIRE(std::getline(ifs, line));
+         REQUIRE(line == "to file");
+      }
+      posix_util::Process attributed("true"); // Attributes which cannot be applied fail the child
+      attributed.set_builtin();
+      posix_util::SpawnAttributes attributes;
+      attributes.cpus = { CPU_SETSIZE - 1 };
+      REQUIRE(attributed.set_spawn_attributes(attributes));
+      std::vector<std::string> no_args;
+      REQUIRE(! attributed.sync_execute(no_args, false, true));
+      REQUIRE(attributed.get_pid() > 0);
+      REQUIRE(attributed.status() == 1);
+      posix_util::Builtins::instance().add("greet", [](const std::vector<std::string>& args, std::string& out,
+                                                       std::string&)
+      {
+         out = "hello " + args.at(0) + "\n";
+         return 0;
+      });
+      posix_util::Process greet("greet");
+      greet.set_builtin();
+      args = { "builtin" };
+      REQUIRE(greet.sync_execute(args, true));
+      REQUIRE(greet.raw_output() == "hello builtin\n");
+      posix_util::Builtins::instance().remove("greet");
+      REQUIRE(! posix_util::Builtins::instance().contains("greet"));
+      std::filesystem::remove(file);
+      std::cout << "Builtin commands complete" << std::endl;
+   }
 }
 
 TEST_CASE( "asynchronous tests", "[async]" )
@@ -226,6 +840,309 @@ TEST_CASE( "asynchronous tests", "[async]" )
       std::cout << "Async stdout/err with async read complete" << std::endl;
    }
 
+   SECTION( "Async kill_all" )
+   {
+      std::vector<std::shared_ptr<posix_util::Process>> processes;
+      for (int i=0; i<16; i++)
+      {
+         std::shared_ptr<posix_util::Process> psleep = std::make_shared<posix_util::Process>("sleep");
+         std::vector<std::string> args = {  "30" };
+         REQUIRE(psleep->async_execute(args, psleep));
+         processes.push_back(psleep);
+      }
+      auto start = std::chrono::steady_clock::now();
+      posix_util::TerminationLadder ladder{ {SIGTERM, 300}, {SIGKILL, 0} };
+      REQUIRE(posix_util::Process::kill_all(processes, ladder) == 16);
+      auto kill_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      REQUIRE(kill_time.count() < 100);
+      int timeout = 5000;
+      bool any_running = true;
+      while ( (any_running) && (timeout > 0) )
+      {
+         any_running = false;
+         for (const std::shared_ptr<posix_util::Process>& p : processes)
+            any_running = any_running || p->running();
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(! any_running);
+      std::cout << "Async kill_all complete" << std::endl;
+   }
+
+   SECTION( "Async wall and idle timeouts" )
+   {
+      std::shared_ptr<posix_util::Process> pwall = std::make_shared<posix_util::Process>("sleep");
+      std::shared_ptr<posix_util::Process> pidle = std::make_shared<posix_util::Process>("sleep");
+      std::shared_ptr<posix_util::Process> pquick = std::make_shared<posix_util::Process>("sleep");
+      std::vector<std::string> args = {  "30" };
+      pwall->set_timeouts(300);
+      REQUIRE(pwall->async_execute(args, pwall));
+      pidle->set_timeouts(0, 300);
+      REQUIRE(pidle->async_execute(args, pidle));
+      std::vector<std::string> quick_args = {  "0.1" };
+      pquick->set_timeouts(5000, 5000);
+      REQUIRE(pquick->async_execute(quick_args, pquick));
+      int timeout = 5000;
+      while ( ( (pwall->running()) || (pidle->running()) || (pquick->running()) ) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      REQUIRE(pwall->timed_out() == posix_util::Timeout::wall);
+      REQUIRE(pidle->timed_out() == posix_util::Timeout::idle);
+      REQUIRE(pquick->timed_out() == posix_util::Timeout::none);
+      REQUIRE(pquick->status() == 0);
+      std::cout << "Async wall and idle timeouts complete" << std::endl;
+   }
+
+   SECTION( "Async background drain" )
+   {
+      std::shared_ptr<posix_util::Process> phead = std::make_shared<posix_util::Process>("head");
+      phead->set_background_drain();
+      std::vector<std::string> args = {  "-c", "1000000", "/dev/zero" };
+      REQUIRE(phead->async_execute(args, phead, true, true));
+      int timeout = 5000;
+      while ( (phead->running()) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      REQUIRE(phead->status() == 0);
+      REQUIRE(phead->raw_output().size() == 1000000);
+      REQUIRE(phead->raw_error().empty());
+      auto open_fds = []()
+      {
+         return std::distance(std::filesystem::directory_iterator("/proc/self/fd"), std::filesystem::directory_iterator());
+      };
+      auto fds_before = open_fds();
+      std::shared_ptr<posix_util::Process> psh = std::make_shared<posix_util::Process>("sh");
+      psh->set_background_drain();
+      args = { "-c", "sleep 0.5 &" }; // The pipe stays open after the child exits, until it is run again
+      for (int run = 0; run < 2; run++)
+      {
+         REQUIRE(psh->async_execute(args, psh, true, false));
+         timeout = 5000;
+         while ( (psh->running()) && (timeout > 0) )
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            timeout -= 50;
+         }
+         REQUIRE(timeout > 0);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+      REQUIRE(open_fds() == fds_before);
+      std::cout << "Async background drain complete" << std::endl;
+   }
+
+   SECTION( "Async capture budget backpressure" )
+   {
+      posix_util::CaptureBudget& budget = posix_util::CaptureBudget::instance();
+      budget.set_limit(1024 * 1024);
+      budget.set_max_throttle(0); // Throttle until memory is released
+      std::shared_ptr<posix_util::Process> phead = std::make_shared<posix_util::Process>("head");
+      phead->set_background_drain();
+      std::vector<std::string> args = {  "-c", "8000000", "/dev/zero" };
+      REQUIRE(phead->async_execute(args, phead, true, false));
+      int timeout = 5000;
+      while ( (budget.metrics().throttled == 0) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+         timeout -= 10;
+      }
+      REQUIRE(budget.metrics().throttled > 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      REQUIRE(phead->running()); // Blocked on the full pipe
+      REQUIRE(budget.used() < 4 * 1024 * 1024);
+      budget.set_limit(0);
+      while ( (phead->running()) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      REQUIRE(phead->raw_output().size() == 8000000);
+      posix_util::CaptureBudget::Metrics metrics = budget.metrics();
+      REQUIRE(metrics.throttled == 0);
+      REQUIRE(metrics.throttle_events > 0);
+      REQUIRE(metrics.throttled_ns >= 200000000ULL);
+      REQUIRE(metrics.peak >= 1024 * 1024);
+      std::size_t used = budget.used();
+      phead->clear_captures();
+      REQUIRE(budget.used() <= used - 8000000);
+
+      budget.set_limit(1024 * 1024);
+      budget.set_max_throttle(10); // Throttled pipes are still read so waiting for exit cannot deadlock
+      args = {  "-c", "3000000", "/dev/zero" };
+      REQUIRE(phead->async_execute(args, phead, true, false));
+      timeout = 10000;
+      while ( (phead->running()) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      REQUIRE(phead->raw_output().size() == 3000000);
+      REQUIRE(budget.metrics().throttle_events > metrics.throttle_events);
+      budget.set_limit(0);
+      budget.set_max_throttle(100);
+      std::cout << "Async capture budget backpressure complete" << std::endl;
+   }
+
+   SECTION( "Async side channel" )
+   {
+      std::shared_ptr<posix_util::Process> ptester_process = std::make_shared<posix_util::Process>("./cmake-build-debug/tester");
+      ptester_process->set_background_drain();
+      ptester_process->set_side_channel();
+      std::vector<std::string> args = {  "0", "async", "-", "100" };
+      REQUIRE(ptester_process->async_execute(args, ptester_process, true, false));
+      int timeout = 5000;
+      while ( (ptester_process->messages().size() < 2) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+         timeout -= 10;
+      }
+      REQUIRE(ptester_process->messages() == std::vector<std::string>{ "line=async", "status=0" });
+      while ( (ptester_process->running()) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      REQUIRE(ptester_process->messages().size() == 2);
+      std::cout << "Async side channel complete" << std::endl;
+   }
+
+   SECTION( "Async result region" )
+   {
+      std::shared_ptr<posix_util::Process> ptester_process = std::make_shared<posix_util::Process>("./cmake-build-debug/tester");
+      REQUIRE(ptester_process->set_result_region(4096));
+      std::vector<std::string> args = {  "0", "a\nb\nc", "-", "0", "100" };
+      REQUIRE(ptester_process->async_execute(args, ptester_process));
+      REQUIRE(ptester_process->wait_result(2, 5000) >= 2);
+      REQUIRE(! ptester_process->result_complete());
+      REQUIRE(ptester_process->result().substr(0, 2) == "a\n");
+      REQUIRE(ptester_process->wait_result(100, 5000) == 6);
+      REQUIRE(ptester_process->result_complete());
+      REQUIRE(ptester_process->result() == "a\nb\nc\n");
+      int timeout = 5000;
+      while ( (ptester_process->running()) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      std::shared_ptr<posix_util::Process> psilent = std::make_shared<posix_util::Process>("sleep");
+      REQUIRE(psilent->set_result_region(4096)); // Exits without publishing or completing the region
+      args = { "0.2" };
+      REQUIRE(psilent->async_execute(args, psilent));
+      auto start = std::chrono::steady_clock::now();
+      REQUIRE(psilent->wait_result(1) == 0);
+      REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+      REQUIRE(! psilent->result_complete());
+      std::cout << "Async result region complete" << std::endl;
+   }
+
+   SECTION( "Async run function" )
+   {
+      std::shared_ptr<posix_util::Process> prunner = std::make_shared<posix_util::Process>();
+      std::shared_ptr<posix_util::Process> pstuck = std::make_shared<posix_util::Process>();
+      pstuck->set_timeouts(300);
+      REQUIRE(prunner->async_run([](std::string& result)
+      {
+         for (int i = 0; i < 1000; i++)
+            result += std::to_string(i) + "\n";
+         return 0;
+      }, prunner));
+      REQUIRE(pstuck->async_run([](std::string&)
+      {
+         std::this_thread::sleep_for(std::chrono::seconds(30));
+         return 0;
+      }, pstuck));
+      int timeout = 5000;
+      while ( ( (prunner->running()) || (pstuck->running()) ) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      REQUIRE(prunner->status() == 0);
+      REQUIRE(prunner->run_result().substr(0, 4) == "0\n1\n");
+      REQUIRE(prunner->run_result().size() == 3890);
+      REQUIRE(pstuck->timed_out() == posix_util::Timeout::wall);
+      REQUIRE(pstuck->run_result().empty());
+      std::cout << "Async run function complete" << std::endl;
+   }
+
+   SECTION( "Async NUMA spreading" )
+   {
+      std::filesystem::path root = "./cmake-build-debug/numa-spread-test"; // A simulated two node host
+      for (const char* node : { "node0", "node1" })
+      {
+         std::filesystem::create_directories(root / node);
+         std::ofstream(root / node / "cpulist") << allowed_cpu() << std::endl;
+      }
+      posix_util::NumaPlacement two_nodes(root.string());
+      std::filesystem::remove_all(root);
+      REQUIRE(two_nodes.nodes() == 2);
+      std::vector<std::shared_ptr<posix_util::Process>> spread;
+      std::vector<std::string> args = { "0.3" };
+      for (int i = 0; i < 3; i++)
+      {
+         spread.push_back(std::make_shared<posix_util::Process>("sleep"));
+         spread.back()->set_numa_spread(true, &two_nodes);
+         REQUIRE(spread.back()->async_execute(args, spread.back()));
+         REQUIRE(spread.back()->numa_node() == i % 2);
+      }
+      REQUIRE(two_nodes.live(0) == 2);
+      REQUIRE(two_nodes.live(1) == 1);
+      int timeout = 5000;
+      while ( (std::any_of(spread.begin(), spread.end(), [](const std::shared_ptr<posix_util::Process>& p)
+                           { return p->running(); })) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         timeout -= 50;
+      }
+      REQUIRE(timeout > 0);
+      for (const std::shared_ptr<posix_util::Process>& p : spread)
+         REQUIRE(p->numa_node() == -1);
+      REQUIRE(two_nodes.live(0) == 0);
+      REQUIRE(two_nodes.live(1) == 0);
+      std::cout << "Async NUMA spreading complete" << std::endl;
+   }
+
+   SECTION( "Async notification fd" )
+   {
+      int notify_fd = posix_util::Process::notification_fd();
+      REQUIRE(notify_fd >= 0);
+      REQUIRE(posix_util::Process::notification_fd() == notify_fd);
+      std::vector<std::shared_ptr<posix_util::Process>> processes;
+      for (int i=0; i<3; i++)
+      {
+         std::shared_ptr<posix_util::Process> ptester_process = std::make_shared<posix_util::Process>("./cmake-build-debug/tester");
+         std::vector<std::string> args = {  std::to_string(i), "notified", "-", "200" };
+         REQUIRE(ptester_process->async_execute(args, ptester_process, true, false));
+         processes.push_back(ptester_process);
+      }
+      std::vector<std::shared_ptr<posix_util::Process>> completed, output;
+      int timeout = 5000;
+      while ( (completed.size() < processes.size()) && (timeout > 0) )
+      {
+         struct pollfd pfd = { notify_fd, POLLIN, 0 };
+         if (poll(&pfd, 1, 100) > 0)
+            posix_util::Process::async_drain(completed, &output);
+         timeout -= 100;
+      }
+      REQUIRE(completed.size() == processes.size());
+      for (const std::shared_ptr<posix_util::Process>& p : completed)
+      {
+         REQUIRE(p->raw_output() == "notified\n");
+         REQUIRE(std::find(processes.begin(), processes.end(), p) != processes.end());
+      }
+      std::cout << "Async notification fd complete" << std::endl;
+   }
+
    SECTION( "Async multithread" )
    {
       const unsigned int nt = std::thread::hardware_concurrency();
@@ -276,4 +1193,230 @@ TEST_CASE( "asynchronous tests", "[async]" )
       REQUIRE(timeout > 0);
       std::cout << "Async multithread complete" << std::endl;
    }
-};
\ No newline at end of file
+};
+
+TEST_CASE( "co-process pool", "[pool]" )
+{
+   SECTION( "Requests, crashes and recycling" )
+   {
+      posix_util::CoProcessPool pool("./cmake-build-debug/tester", { "--coprocess" }, 2, 5);
+      REQUIRE(pool.start());
+      std::string response;
+      REQUIRE(pool.request("hello", response, 5000));
+      std::string pid = response.substr(0, response.find(' '));
+      REQUIRE(response == pid + " hello");
+      REQUIRE(pool.request("crash", response, 5000) == false);
+      REQUIRE(pool.restarts() == 2); // The retry crashes the replacement too
+      std::vector<std::thread> threads;
+      std::atomic<int> ok{0};
+      for (int t=0; t<4; t++)
+      {
+         threads.emplace_back([&pool, &ok, t]()
+         {
+            std::string reply;
+            for (int i=0; i<25; i++)
+            {
+               std::string request = std::to_string(t) + ":" + std::to_string(i);
+               if ( (pool.request(request, reply, 5000)) && (reply.substr(reply.find(' ') + 1) == request) )
+                  ok++;
+            }
+         });
+      }
+      for (std::thread& thread : threads)
+         thread.join();
+      REQUIRE(ok == 100);
+      REQUIRE(pool.recycles() >= 100 / 5 - 2);
+      pool.stop();
+      REQUIRE(pool.request("stopped", response) == false);
+      posix_util::CoProcessPool limited("./cmake-build-debug/tester", { "--coprocess" }, 1);
+      limited.set_max_response(32);
+      REQUIRE(limited.start());
+      REQUIRE(limited.request("short", response, 5000));
+      REQUIRE(limited.request(std::string(100, 'x'), response, 5000) == false);
+      REQUIRE(limited.last_error().find("exceeds max_response") != std::string::npos);
+      REQUIRE(limited.restarts() == 2);
+      REQUIRE(limited.request("short", response, 5000));
+      limited.stop();
+      std::cout << "Co-process pool complete" << std::endl;
+   }
+}
+
+TEST_CASE( "command lines", "[cmdline]" )
+{
+   SECTION( "Parsing" )
+   {
+      posix_util::CommandLine line("printf 'a b\\n' | tr a-z A-Z 2>&1 && echo \"say \\\"hi\\\"\" x\\ y >>out.txt");
+      REQUIRE(line.is_valid());
+      REQUIRE(line.pipelines().size() == 2);
+      const posix_util::CommandLine::Pipeline& first = line.pipelines()[0];
+      REQUIRE(first.size() == 2);
+      REQUIRE(first[0].argv == std::vector<std::string>{ "printf", "a b\\n" });
+      REQUIRE(first[1].argv == std::vector<std::string>{ "tr", "a-z", "A-Z" });
+      REQUIRE(first[1].redirections.size() == 1);
+      REQUIRE(first[1].redirections[0].source_fd == STDOUT_FILENO);
+      const posix_util::CommandLine::Command& echo = line.pipelines()[1][0];
+      REQUIRE(echo.argv == std::vector<std::string>{ "echo", "say \"hi\"", "x y" });
+      REQUIRE(echo.redirections[0].path == "out.txt");
+      REQUIRE(echo.redirections[0].flags == (O_WRONLY | O_CREAT | O_APPEND));
+      for (const char* unsupported : { "echo $HOME", "ls *.cc", "true; false", "true || false", "X=1 env",
+                                       "cat <<EOF", "echo `date`", "sleep 1 &", "3>f true", "| wc", "echo >",
+                                       "echo 'open", "(true)", "cd /tmp", "echo a\necho b" })
+      {
+         posix_util::CommandLine rejected(unsupported);
+         REQUIRE(! rejected.is_valid());
+         REQUIRE(! rejected.last_error().empty());
+         REQUIRE(! rejected.run());
+      }
+      posix_util::CommandLine quoted("echo 'a\nb' \\\n c");
+      REQUIRE(quoted.is_valid());
+      REQUIRE(quoted.pipelines()[0][0].argv == std::vector<std::string>{ "echo", "a\nb", "c" });
+      std::cout << "Command line parsing complete" << std::endl;
+   }
+
+   SECTION( "Pipelines and redirections" )
+   {
+      posix_util::CommandLine count("seq 1 5 | grep -v 3 | wc -l");
+      REQUIRE(count.run(true));
+      REQUIRE(count.output() == "4\n");
+      std::string file = "./cmake-build-debug/cmdline-test.txt";
+      posix_util::CommandLine write("echo hello > " + file + " && echo more >> " + file + " && cat < " + file);
+      REQUIRE(write.run(true));
+      REQUIRE(write.output() == "hello\nmore\n");
+      posix_util::CommandLine errors("ls /nonexistent 2>&1");
+      REQUIRE(! errors.run(true));
+      REQUIRE(errors.status() == 2);
+      REQUIRE(errors.output().find("No such file") != std::string::npos);
+      posix_util::CommandLine skipped("false && echo skipped");
+      REQUIRE(! skipped.run(true));
+      REQUIRE(skipped.output().empty());
+      posix_util::CommandLine missing("cat < /nonexistent/input | wc -c");
+      REQUIRE(! missing.run(true));
+      REQUIRE(missing.last_error().find("/nonexistent/input") != std::string::npos);
+      posix_util::CommandLine large("seq 1 200000 | cat");
+      REQUIRE(large.run(true));
+      REQUIRE(large.output().size() == 1288895);
+      std::string hijack = "./ls"; // Not run instead of ls on PATH
+      {
+         std::ofstream ofs(hijack);
+         ofs << "#!/bin/sh\necho HIJACKED" << std::endl;
+      }
+      std::filesystem::permissions(hijack, std::filesystem::perms::owner_all);
+      posix_util::CommandLine listing("ls /");
+      REQUIRE(listing.run(true));
+      REQUIRE(listing.output().find("HIJACKED") == std::string::npos);
+      std::filesystem::remove(hijack);
+      posix_util::CommandLine unknown("no-such-command-on-path");
+      REQUIRE(! unknown.run());
+      REQUIRE(unknown.last_error().find("command not found") != std::string::npos);
+      posix_util::CommandLine slow("sleep 30 | cat");
+      slow.set_timeout(200);
+      auto start = std::chrono::steady_clock::now();
+      REQUIRE(! slow.run(true));
+      REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+      REQUIRE(slow.last_error().find("timed out") != std::string::npos);
+      std::filesystem::remove(file);
+      std::cout << "Pipelines and redirections complete" << std::endl;
+   }
+}
+
+TEST_CASE( "timer wheel", "[timer]" )
+{
+   SECTION( "Many timers" )
+   {
+      const int n = 50000;
+      std::atomic<int> fired{0}, early{0};
+      posix_util::Timer& timer = posix_util::Timer::instance();
+      auto start = posix_util::Timer::clock::now();
+      std::vector<posix_util::Timer::timer_id> ids;
+      for (int i=0; i<n; i++)
+      {
+         int delay = (i * 7) % 3000;
+         ids.push_back(timer.schedule(delay, [&fired, &early, start, delay]()
+         {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(posix_util::Timer::clock::now() - start);
+            if (elapsed.count() < delay) early++;
+            fired++;
+         }));
+      }
+      int cancelled = 0;
+      for (int i=0; i<n; i += 10)
+         if (timer.cancel(ids[i])) cancelled++;
+      int timeout = 10000;
+      while ( (fired + cancelled < n) && (timeout > 0) )
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+         timeout -= 100;
+      }
+      REQUIRE(fired + cancelled == n);
+      REQUIRE(early == 0);
+      REQUIRE(timer.pending() == 0);
+      std::cout << "Many timers complete" << std::endl;
+   }
+}
+
+static std::vector<std::string> reference_split(const std::string& s, const std::string& delim, const std::string& chars = " \t")
+//-----------------------------------------------------------------------------------------------------------------------
+{
+   std::vector<std::string> tokens;
+   std::size_t pos = s.find_first_not_of(delim);
+   while (pos != std::string::npos)
+   {
+      std::size_t next = s.find_first_of(delim, pos);
+      std::string token = (next == std::string::npos) ? s.substr(pos) : s.substr(pos, next - pos);
+      auto b = token.find_first_not_of(chars);
+      auto e = token.find_last_not_of(chars);
+      tokens.push_back((b == std::string::npos) ? "" : token.substr(b, e - b + 1));
+      if (next == std::string::npos) break;
+      pos = s.find_first_not_of(delim, next);
+   }
+   return tokens;
+}
+
+TEST_CASE( "line splitting", "[split]" )
+{
+   std::string alphabet = "ab \t\n,;xyz\r";
+   unsigned int seed = 17;
+   auto next_random = [&seed]() { seed = seed * 1103515245 + 12345; return (seed >> 16) & 0x7fff; };
+   const std::vector<std::string> delimiters = { "\n", "\n;", ",;\n\r", ",;\n\r\t" };
+
+   SECTION( "Matches find_first_of splitting" )
+   {
+      for (int len : { 0, 1, 15, 16, 17, 63, 64, 65, 1000, 100000 })
+      {
+         std::string s;
+         for (int i=0; i<len; i++)
+            s.push_back(alphabet[next_random() % alphabet.size()]);
+         for (const std::string& delim : delimiters)
+         {
+            std::vector<std::string_view> views;
+            posix_util::LineSplitter::split(s, views, delim);
+            std::vector<std::string> expected = reference_split(s, delim);
+            REQUIRE(views.size() == expected.size());
+            for (std::size_t i=0; i<views.size(); i++)
+               REQUIRE(views[i] == expected[i]);
+            std::vector<std::string> tokens;
+            posix_util::Process::split(s, tokens, delim);
+            REQUIRE(tokens == expected);
+         }
+      }
+      std::cout << "Matches find_first_of splitting complete (" << posix_util::LineSplitter::simd_level() << ")" << std::endl;
+   }
+
+   SECTION( "Parallel split" )
+   {
+      std::string s;
+      for (int i=0; i<200000; i++)
+         s += "  line " + std::to_string(i) + ((i % 7 == 0) ? "\n\n" : "\n");
+      std::size_t threshold = posix_util::LineSplitter::parallel_threshold;
+      posix_util::LineSplitter::parallel_threshold = 1024;
+      posix_util::LineSplitter::parallel_threads = 4;
+      std::vector<std::string_view> views;
+      posix_util::LineSplitter::split(s, views);
+      posix_util::LineSplitter::parallel_threshold = threshold;
+      posix_util::LineSplitter::parallel_threads = 0;
+      REQUIRE(views.size() == 200000);
+      for (int i=0; i<200000; i++)
+         REQUIRE(views[i] == "line " + std::to_string(i));
+      std::cout << "Parallel split complete" << std::endl;
+   }
+}
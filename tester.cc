@@ -7,6 +7,9 @@
 #include <cstring>
 #include <unistd.h>
 
+#include "SideChannel.hh"
+#include "ResultRegion.hh"
+
 inline std::string trim(const std::string &str,  std::string chars  = " \t")
 //----------------------------------------------------------------
 {
@@ -30,9 +33,37 @@ std::string read_file(char *filepath)
    return ss.str();
 }
 
+// Worker for CoProcessPool tests: answers each length prefixed request with "<pid> <request>", exiting without
+// a response on "crash".
+static int coprocess()
+//--------------------
+{
+   while (true)
+   {
+      unsigned char header[4];
+      if (fread(header, 1, sizeof(header), stdin) != sizeof(header))
+         return 0;
+      std::size_t len = (static_cast<std::size_t>(header[0]) << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+      std::string request(len, '\0');
+      if ( (len > 0) && (fread(request.data(), 1, len, stdin) != len) )
+         return 1;
+      if (request == "crash")
+         _exit(3);
+      std::string response = std::to_string(getpid()) + " " + request;
+      len = response.size();
+      unsigned char out[4] = { static_cast<unsigned char>(len >> 24), static_cast<unsigned char>(len >> 16),
+                               static_cast<unsigned char>(len >> 8), static_cast<unsigned char>(len) };
+      fwrite(out, 1, sizeof(out), stdout);
+      fwrite(response.data(), 1, response.size(), stdout);
+      fflush(stdout);
+   }
+}
+
 int main(int argc, char **argv)
 //-------------------------------
 {
+   if ( (argc > 1) && (strcmp(argv[1], "--coprocess") == 0) )
+      return coprocess();
    std::string output, error;
    std::vector<std::string> output_lines, error_lines;
    int sleepms = 0, lines_sleepms = 0, status = 0;
@@ -49,6 +80,8 @@ int main(int argc, char **argv)
       char* prealpath = realpath(argv[2], buf);
       if (prealpath != nullptr)
          output = read_file(prealpath);
+      else if (access(argv[2], R_OK) == 0) // eg /proc/self/fd/N for a memfd
+         output = read_file(argv[2]);
       else
          output = argv[2];
       if (trim(output) == "")
@@ -66,6 +99,8 @@ int main(int argc, char **argv)
       char* prealpath = realpath(argv[3], buf);
       if (prealpath != nullptr)
          error = read_file(prealpath);
+      else if (access(argv[3], R_OK) == 0) // eg /proc/self/fd/N for a memfd
+         error = read_file(argv[3]);
       else
          error = argv[3];
       if (trim(error) == "")
@@ -90,6 +125,9 @@ int main(int argc, char **argv)
       if (s != "")
          lines_sleepms = std::stoi(s);
    }
+   posix_util::SideChannel side_channel;
+   bool is_side_channel = side_channel.available();
+   posix_util::ResultRegion result_region;
    auto it1= output_lines.begin();
    auto it2= error_lines.begin();
    while (true)
@@ -97,6 +135,9 @@ int main(int argc, char **argv)
       if (it1 != output_lines.end())
       {
          std::cout << *it1 << std::endl << std::flush;
+         if (is_side_channel)
+            side_channel.send("line=" + *it1);
+         result_region.append(*it1 + "\n");
          ++it1;
       }
       if (it2 != error_lines.end())
@@ -109,6 +150,9 @@ int main(int argc, char **argv)
       std::this_thread::sleep_for(std::chrono::milliseconds(lines_sleepms));
 //      int ret = usleep(lines_sleepms*1000);
    }
+   if (is_side_channel)
+      side_channel.send("status=" + std::to_string(status));
+   result_region.finish();
    if (sleepms > 0)
       std::this_thread::sleep_for(std::chrono::milliseconds(sleepms));
    return status;